@@ -2,14 +2,143 @@
  * csim.c:  
  * A cache simulator that can replay traces (from Valgrind) and output
  * statistics for the number of hits, misses, and evictions.
- * The replacement policy is LRU.
+ * The replacement policy is LRU by default; --policy selects LIP, BIP,
+ * SRRIP, BRRIP, or DIP/DRRIP with set dueling.
  *
  * Implementation and assumptions:
  *  1. Each load/store can cause at most one cache miss plus a possible eviction.
- *  2. Instruction loads (I) are ignored.
+ *  2. Instruction loads (I) are ignored, unless --icache gives them their
+ *  own L1I cache (split I/D mode).
  *  3. Data modify (M) is treated as a load followed by a store to the same
  *  address. Hence, an M operation can result in two cache hits, or a miss and a
  *  hit plus a possible eviction.
+ *
+ * Instead of a trace file, -g replays a synthetic access stream that is
+ * generated in memory (see generate_trace()), so simulator changes can be
+ * benchmarked reproducibly without Valgrind traces or file I/O.
+ *
+ * --bench runs a fixed matrix of cache geometries over generated patterns
+ * and any recorded traces given as extra arguments, reporting throughput, the
+ * process peak RSS and how much each run raised it as JSON; --baseline
+ * compares the throughput and counters against a stored result.
+ *
+ * --perf counts host cycles, instructions, LLC misses and branch misses of
+ * the simulator itself with perf_event_open(). The trace is then decoded in
+ * full before it is replayed, so parsing, access_data() and the summary can
+ * be counted as separate phases.
+ *
+ * --page-map puts a virtual-to-physical translation in front of
+ * access_data(), since real L2/L3 caches are physically indexed: pages are
+ * mapped 1:1 (identity), to random frames, to frames of the same cache
+ * color, or as recorded in a /proc/<pid>/pagemap dump.
+ *
+ * --index, --sets and --slices model sliced LLCs: the set can be chosen by
+ * XOR folding, an Intel-style complex-addressing slice hash or a modulo
+ * (with a fast reciprocal), so set and slice counts need not be powers of
+ * two. Those index functions keep the whole block address as the tag.
+ *
+ * --victim and --miss-cache attach a small fully-associative buffer to the
+ * cache (Jouppi, ISCA 1990). Hits in it are counted separately; the cache's
+ * own hit/miss/eviction counts are unchanged by it.
+ *
+ * --icache and --l2 turn the simulated cache into the L1D of a split I/D
+ * hierarchy: "I" records go through a separate L1I, and misses of both L1s
+ * can continue into a shared L2 (demand fills only, no write-backs). The
+ * first summary line always reports the L1D.
+ *
+ * --compact rewrites a trace with repeated block-level access sequences
+ * folded into "R reps,n" loop records. When replaying such a record, once
+ * an iteration hits on every access the rest of the loop is credited as
+ * hits without being simulated. Only the first iteration's byte offsets
+ * are kept, so a compacted trace records its block size and is rejected
+ * by runs with smaller blocks, sectors or unaligned regions.
+ *
+ * --reuse tracks the fill time, last touch and hit count of every line and
+ * reports, at eviction, how many lines were dead on arrival (never hit),
+ * how long lines lived and how many hits each fill got.
+ *
+ * --format json|csv prints one machine-readable record with the
+ * configuration, every counter and the replay time, and -o sends all
+ * output to a file. Either one suppresses the .csim_results side file, so
+ * concurrent runs in one directory do not clobber each other.
+ *
+ * --batch runs a manifest of (trace, configuration) jobs on -j worker
+ * threads in one process. Each trace is decoded once, through mmap(), and
+ * shared by reference count between the jobs that replay it; results are
+ * streamed to a single output as JSON lines or CSV.
+ *
+ * --policy replaces LRU with LIP, BIP, SRRIP or BRRIP insertion, or with
+ * DIP/DRRIP, which pick between two of them by set dueling: a few leader
+ * sets always use one policy, a PSEL counter tracks whose leaders miss
+ * less, and the other sets follow the winner. The summary shows the
+ * winner over time.
+ *
+ * --shards computes a miss-ratio curve for every cache size in one pass,
+ * by SHARDS spatial sampling: only blocks whose hash falls below a
+ * threshold are tracked, their reuse distances come from an order
+ * statistics treap, and with --shards-max the threshold drops whenever
+ * the tracked blocks exceed the budget.
+ *
+ * --kv simulates an application-level cache instead (memcached, Redis):
+ * records are "<key>,<size>", the capacity is in bytes, and objects are
+ * replaced by LRU, ARC, LIRS or W-TinyLFU, all adapted to sizes.
+ *
+ * --bloom switches an LRU cache to an engine for huge associativity: a
+ * counting Bloom filter per set proves most misses without a tag scan,
+ * and recency lists replace the per-line age counters.
+ *
+ * --timing adds a trace-driven timing model: records issue at a fixed
+ * rate, misses occupy MSHRs (merging repeated misses to a line in
+ * flight) and take a fixed or bandwidth-queued memory latency. It reports
+ * estimated cycles, AMAT and the average memory-level parallelism.
+ *
+ * The lines of big caches live in 2 MB pages (transparent huge pages, or
+ * with --hugepages hugetlb the reserved hugetlbfs pool) bound to the NUMA
+ * node of the simulating thread, so the host TLB keeps up with multi-GB
+ * simulated LLCs.
+ *
+ * A region map (--regions, --elf-symbols, --heap-log) names address
+ * ranges, e.g. the arrays of the traced program; every access is looked
+ * up by binary search and the summary adds L1 hits, misses and evictions
+ * per region, so misses can be traced back to data structures.
+ * --region-filter drops the accesses outside all regions.
+ *
+ * --ir-cache <dir> keeps, per trace, b and s, the decoded data accesses
+ * bucketed by set in a columnar file (set offsets, then the tags of each
+ * set). Later runs with another E or policy skip the parse and replay the
+ * sets independently on -j threads.
+ *
+ * --two-phase does the same in memory: a parallel radix partition buckets
+ * the trace by set, then -j threads simulate the sets.
+ *
+ * --sectors splits each line into sectors with their own valid bits,
+ * filled on demand; a miss on a resident tag is a sector miss. With
+ * --compress the lines of a set share its data space instead: there are
+ * twice as many tags as lines, and each block takes a hashed compressed
+ * size, so fills may evict several lines.
+ *
+ * --cores co-runs several traces, one per core, on private L1 (and
+ * --l2) caches in front of a shared non-inclusive LLC (--llc). Blocks
+ * leaving a core are reported to the LLC: dirty ones are written back,
+ * and with hints a clean block never reused is demoted while a reused
+ * one is promoted. Every run is done without and with hints. The private
+ * and shared caches are plain ones: side buffers, sectors, compression and
+ * other index functions are rejected rather than applied to one level.
+ *
+ * --diff-test <n> checks the optimized engines (--bloom, the per-set
+ * kernels and --two-phase bucketing, loop skipping) against access_data()
+ * on n random configurations and traces, and reports the first divergent
+ * access (the first divergent record for loop skipping).
+ * Built with -DCSIM_FUZZ, the same check is a libFuzzer target.
+ *
+ * --progress <sec> prints the position, access rate, miss ratio and ETA
+ * of a long replay to stderr from a sampling thread.
+ *
+ * Trace lines are decoded by decode_fields(), which converts the hex
+ * address with an SSSE3 kernel when the host has one and falls back to
+ * sscanf() for anything unusual; --check-decoder fuzzes it against sscanf().
+ *
+ * Build: gcc -O2 -pthread -o csim csim.c -lm
  */  
 
 #include <getopt.h>
@@ -22,6 +151,21 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <elf.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/mempolicy.h>
 
 
 //Globals set by command line args.
@@ -29,17 +173,15 @@ int b = 0; //number of (b) bits
 int s = 0; //number of (s) bits
 int E = 0; //number of lines per set
 
-//Globals derived from command line args.
-int B; //block size in bytes: B = 2^b
-int S; //number of sets: S = 2^s
-
-//Global counters to track cache statistics in access_data().
-int hit_cnt = 0;
-int miss_cnt = 0;
-int evict_cnt = 0;
 
 //Global to control trace output
 int verbosity = 0; //print trace if set
+
+//Globals for the synthetic trace generator (-g, -n, -f, -r).
+char* gen_spec = NULL; //pattern name with an optional ":param" suffix
+long gen_count = 1000000; //number of accesses to generate
+unsigned long long gen_footprint = 16 << 20; //bytes touched by the pattern
+unsigned long long gen_seed = 1; //seed for the generator's PRNG
 /******************************************************************************/
 
 
@@ -50,60 +192,384 @@ typedef unsigned long long int mem_addr_t;
 //TODO - COMPLETE THIS TYPE
 typedef struct cache_line {                    
 	char valid;
+	unsigned char rrpv; //RRIP re-reference prediction, RRPV_MAX = distant
 	mem_addr_t tag;
 	int lru_counter; //Add a data member as needed by your implementation for LRU tracking.
+	int hit_count; //hits since the line was filled
+	long insert_time; //cache clock when the line was filled
+	long last_touch; //cache clock of the last hit or fill
+	unsigned long long sector_valid; //valid bit of each sector (--sectors)
+	unsigned char segs; //compressed size in COMPRESS_SEGS units (--compress)
+	char dirty; //written since the fill (--cores)
 } cache_line_t;
 
 //Type cache_set_t: Use when dealing with cache sets
 //Note: Each set is a pointer to a heap array of one or more cache lines.
 typedef cache_line_t* cache_set_t;
 
+//Number of log2 buckets in the reuse histograms.
+#define REUSE_BUCKETS 48
+
+//Type reuse_stats_t: Dead-block and lifetime statistics (--reuse), taken
+//when lines are evicted from a cache.
+typedef struct reuse_stats {
+    long evicted; //lines evicted
+    long dead; //evicted without a single hit
+    long total_hits; //hits of all evicted lines
+    long lifetime[REUSE_BUCKETS]; //eviction time - fill time
+    long dead_time[REUSE_BUCKETS]; //eviction time - last touch
+    long hits_per_fill[REUSE_BUCKETS]; //hits of a line before its eviction
+    long resident; //lines still valid at the end
+    long resident_dead; //of which never hit
+} reuse_stats_t;
+
+//Index functions for mapping a block address to a set (--index).
+enum { INDEX_MASK, INDEX_XOR, INDEX_COMPLEX, INDEX_MOD };
+
+//Outcome flags returned by cache_access().
+//ACCESS_L2_HIT is only added by access_data() and access_inst().
+//ACCESS_SECTOR_MISS comes with ACCESS_MISS when the tag was resident.
+enum { ACCESS_HIT = 1, ACCESS_MISS = 2, ACCESS_EVICT = 4, ACCESS_VC_HIT = 8,
+    ACCESS_L2_HIT = 16, ACCESS_SECTOR_MISS = 32 };
+
+//Compressed sets (--compress): each set has COMPRESS_TAGS tags per line of
+//data space, and a line takes 1 to COMPRESS_SEGS segments of B / 8 bytes.
+#define COMPRESS_TAGS 2
+#define COMPRESS_SEGS 8
+
+//Replacement and insertion policies (--policy). The LRU family keeps the
+//age counters and differs only in where a fill is inserted: MRU (LRU),
+//LRU position (LIP), mostly LRU position (BIP), or set dueling between
+//LRU and BIP (DIP). The RRIP family evicts by 2-bit re-reference
+//predictions: SRRIP fills with "long", BRRIP mostly with "distant",
+//and DRRIP duels the two.
+enum { POLICY_LRU, POLICY_LIP, POLICY_BIP, POLICY_DIP, POLICY_SRRIP,
+    POLICY_BRRIP, POLICY_DRRIP, NUM_POLICIES };
+const char* policy_names[] = {"lru", "lip", "bip", "dip", "srrip", "brrip", "drrip"};
+#define RRPV_MAX 3
+#define BIP_EPSILON 32 //one in BIP_EPSILON bimodal fills goes to MRU
+#define PSEL_MAX 1023 //10-bit policy selector
+#define DUEL_LEADERS 32 //leader sets per component policy
+#define DUEL_EPOCH 65536 //default accesses per timeline epoch
+
+//Roles of a set under set dueling.
+enum { DUEL_FOLLOWER, DUEL_A, DUEL_B };
+
+//Type duel_run_t: A run of consecutive epochs won by the same policy.
+typedef struct duel_run {
+    int winner; //0 or 1, index into duel_t.policy
+    long epochs;
+} duel_run_t;
+
+//Type duel_t: Set dueling state and statistics of a DIP or DRRIP cache.
+typedef struct duel {
+    int policy[2]; //component policies A and B
+    int stride; //sets per constituency, each has one leader of A and B
+    int psel; //saturating counter, up on A leader misses, down on B's
+    long leader_miss[2]; //misses in the leader sets of A and B
+    long follower_miss[2]; //follower misses while A or B was in use
+    long epoch_len; //accesses per epoch
+    long epoch_left; //accesses until the current epoch ends
+    long epochs_won[2];
+    duel_run_t* timeline; //winner per epoch, run-length encoded
+    int runs;
+    int runs_cap;
+} duel_t;
+
+//Kinds of fully-associative side buffer attached to a cache.
+enum { VC_NONE, VC_VICTIM, VC_MISS };
+
 //Type cache_t: Use when dealing with the cache.
-//Note: A cache is a pointer to a heap array of one or more sets.
-typedef cache_set_t* cache_t;
+//Note: sets is a pointer to a heap array of one or more sets, which
+//point into one contiguous array of lines.
+typedef struct cache {
+    cache_set_t* sets;
+    cache_line_t* lines; //all S * E lines, set by set
+    int backing; //HUGE_* kind of storage behind lines
+    int s; //number of (s) bits per slice
+    int E; //number of lines per set
+    int b; //number of (b) bits
+    int index_fn; //INDEX_* function mapping blocks to sets
+    int slices; //number of LLC slices
+    int slice_sets; //sets per slice, not necessarily a power of two
+
+    //Derived by init_cache().
+    int S; //total number of sets: slices * slice_sets
+    int B; //block size in bytes: B = 2^b
+    int set_bits; //bits needed for a set number within a slice
+    int plain_index; //set if the classic mask index and short tag apply
+    mem_addr_t set_recip, slice_recip, all_recip; //reciprocals for fast_mod()
+
+    //Optional victim or miss cache next to the sets (--victim, --miss-cache).
+    int vc_kind; //VC_* kind of buffer
+    int vc_size; //number of entries
+    int vc_used; //valid entries in vc_blocks
+    mem_addr_t* vc_blocks; //block addresses, most recently used first
+
+    long clock; //accesses so far, the time base of the line timestamps
+    reuse_stats_t* reuse; //dead-block statistics if not NULL (--reuse)
+
+    int policy; //POLICY_* replacement policy
+    unsigned int bip_count; //bimodal fills so far
+    long duel_epoch; //epoch length for DIP/DRRIP, 0 for DUEL_EPOCH
+    duel_t* duel; //set dueling state (DIP, DRRIP), else NULL
+
+    //Bloom-filtered LRU engine (--bloom), see bloom_access().
+    int use_bloom; //requested by the caller of init_cache()
+    int bloom_bits; //log2 of the filter counters per set
+    unsigned char* bloom; //counting Bloom filter of each set, or NULL
+    int* lru_prev; //recency list links of each line, -1 at the ends
+    int* lru_next;
+    int* lru_head; //MRU line of each set
+    int* lru_tail; //LRU line of each set
+    int* lru_used; //valid lines of each set, always ways 0..used-1
+
+    //Sectored lines (--sectors) and compressed sets (--compress).
+    int sector_bits; //log2 of the sectors per line, 0 for whole lines
+    double compress_ratio; //mean compression ratio, 0 when off
+    int data_ways; //lines of data space per set when compressed (E counts tags)
+
+    //Write-back state for the multi-core mode (--cores).
+    int store; //set by the caller for a store, which dirties the line
+    mem_addr_t victim_block; //block evicted by the last ACCESS_EVICT access
+    int victim_hits; //its hits while resident
+    char victim_dirty; //whether it was dirty
+
+    //Counters to track cache statistics in cache_access().
+    long hit_cnt;
+    long miss_cnt;
+    long evict_cnt;
+    long vc_hit_cnt; //misses served by the side buffer
+    long vc_insert_cnt; //blocks put into the side buffer
+    long vc_evict_cnt; //blocks dropped from the side buffer
+    long sector_miss_cnt; //misses on a resident tag, included in miss_cnt
+    long space_evict_cnt; //evictions only to free data space, in evict_cnt
+    long long fill_segs; //compressed sizes of all fills, for the average
+} cache_t;
+
+//Type trace_rec_t: One decoded trace record (op is 'L', 'S', 'M' or 'I').
+typedef struct trace_rec {
+    mem_addr_t addr;
+    unsigned int len;
+    char op;
+} trace_rec_t;
+
+//Type trace_buf_t: A growable in-memory array of trace records.
+typedef struct trace_buf {
+    trace_rec_t* recs;
+    size_t n;
+    size_t cap;
+} trace_buf_t;
 
 // Create the cache we're simulating. 
-//Note: A cache is a pointer to a heap array of one or more cache sets.
 cache_t cache;  
 
+//Split I/D mode: "I" records go to their own L1I (--icache), and both L1s
+//may share an L2 (--l2). Both are off by default.
+cache_t icache;
+cache_t l2cache;
+int split_i = 0; //simulate "I" records in icache if set
+int use_l2 = 0; //forward L1 misses to l2cache if set
+
+//Streams that reach the shared L2, for per-stream L2 statistics.
+enum { STREAM_DATA, STREAM_INST };
+long l2_stream_hits[2];
+long l2_stream_misses[2];
+
+//Loop iterations of compacted traces that were credited without replay.
+long loop_iters_skipped = 0;
+
+//Index configuration of the simulated cache, set by command line args.
+int index_fn = INDEX_MASK; //set index function (--index)
+int num_slices = 1; //number of slices (--slices)
+int num_sets = 0; //sets per slice if not 2^s (--sets)
+
+//How line storage is backed (--hugepages). HUGE_THP only asks the kernel
+//for transparent huge pages, HUGE_TLB first tries the hugetlbfs pool, which
+//other processes may rely on, so it is opt-in.
+enum { HUGE_OFF, HUGE_THP, HUGE_TLB };
+const char* backing_names[] = {"malloc", "thp", "hugetlb"};
+int hugepage_mode = HUGE_THP;
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/* 
+ * bind_local:
+ * Asks the kernel to place the pages of [addr, addr + len) on the NUMA
+ * node of the calling thread. The pages are not touched yet, so they are
+ * allocated there on first use. Failures (no NUMA support) are harmless.
+ */                    
+void bind_local(void* addr, size_t len) {
+    unsigned int cpu, node;
+    unsigned long mask[4] = {0};
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= 8 * sizeof(mask)) {
+        return;
+    }
+    mask[node / 64] = 1UL << (node % 64);
+    syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, 8 * sizeof(mask), 0);
+}
+
+/* 
+ * alloc_lines:
+ * Returns zeroed storage for n cache lines and records in *backing how it
+ * was allocated. Arrays of at least one huge page are mapped with 2 MB
+ * pages: as an anonymous mapping marked for transparent huge pages, or
+ * with HUGE_TLB from the hugetlbfs pool if it has room. Mapped storage is
+ * bound to the NUMA node of the allocating thread, which is the thread
+ * that simulates the cache (batch jobs allocate inside their worker).
+ */                    
+cache_line_t* alloc_lines(size_t n, int* backing) {
+    size_t bytes = n * sizeof(cache_line_t);
+    void* p = MAP_FAILED;
+
+    if (hugepage_mode == HUGE_OFF || bytes < HUGE_PAGE_SIZE) {
+        *backing = HUGE_OFF;
+        return calloc(n, sizeof(cache_line_t));
+    }
+    bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (hugepage_mode == HUGE_TLB) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        *backing = HUGE_TLB;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(p, bytes, MADV_HUGEPAGE);
+        *backing = HUGE_THP;
+    }
+    bind_local(p, bytes);
+    return p;
+}
+
+/* 
+ * free_lines:
+ * Releases storage from alloc_lines().
+ */                    
+void free_lines(cache_line_t* lines, size_t n, int backing) {
+    size_t bytes = n * sizeof(cache_line_t);
+
+    if (backing == HUGE_OFF) {
+        free(lines);
+        return;
+    }
+    munmap(lines, (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+}
+
 /* 
  * init_cache:
- * Allocates the data structure for a cache with S sets and E lines per set.
+ * Allocates the data structure for a cache with c->S sets and c->E lines
+ * per set, laid out as c->slices slices of c->slice_sets sets each.
+ * The caller fills in the geometry (s, E, b, index_fn, slices and
+ * optionally slice_sets); everything else is derived here.
  * Initializes all valid bits and tags with 0s.
  */                    
-void init_cache() {
+void init_cache(cache_t* c) {
 	
     // Calculation for sets and block size
-	S = 1 << s; 
-    B = 1 << b; 
+    if (c->slices < 1) {
+        c->slices = 1;
+    }
+    if (c->slice_sets < 1) {
+        c->slice_sets = 1 << c->s;
+    }
+	c->S = c->slices * c->slice_sets; 
+    c->B = 1 << c->b; 
+    c->set_bits = 0;
+    while ((1 << c->set_bits) < c->slice_sets) {
+        c->set_bits++;
+    }
+    c->set_recip = ~0ULL / c->slice_sets;
+    c->slice_recip = ~0ULL / c->slices;
+    c->all_recip = ~0ULL / c->S;
+
+    //The plain bit-mask index keeps the short tag, all others the block address.
+    c->plain_index = c->index_fn == INDEX_MASK && c->slices == 1 &&
+        c->slice_sets == (1 << c->s);
+    c->hit_cnt = 0;
+    c->miss_cnt = 0;
+    c->evict_cnt = 0;
+    c->vc_hit_cnt = 0;
+    c->vc_insert_cnt = 0;
+    c->vc_evict_cnt = 0;
+    c->sector_miss_cnt = 0;
+    c->space_evict_cnt = 0;
+    c->fill_segs = 0;
+    c->vc_used = 0;
+    c->vc_blocks = NULL;
+    c->clock = 0;
+    if (c->reuse != NULL) {
+        memset(c->reuse, 0, sizeof(reuse_stats_t));
+    }
+    c->bip_count = 0;
+    c->duel = NULL;
+    if (c->policy == POLICY_DIP || c->policy == POLICY_DRRIP) {
+        int leaders = c->S / 4 < DUEL_LEADERS ? c->S / 4 : DUEL_LEADERS;
+        c->duel = calloc(1, sizeof(duel_t));
+        if (c->duel == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        c->duel->policy[0] = c->policy == POLICY_DIP ? POLICY_LRU : POLICY_SRRIP;
+        c->duel->policy[1] = c->policy == POLICY_DIP ? POLICY_BIP : POLICY_BRRIP;
+        c->duel->stride = c->S / (leaders > 0 ? leaders : 1);
+        c->duel->psel = PSEL_MAX / 2;
+        c->duel->epoch_len = c->duel_epoch > 0 ? c->duel_epoch : DUEL_EPOCH;
+        c->duel->epoch_left = c->duel->epoch_len;
+    }
+    if (c->vc_kind != VC_NONE) {
+        c->vc_blocks = malloc(sizeof(mem_addr_t) * c->vc_size);
+        if (c->vc_size < 1 || c->vc_blocks == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
 	
 	// Allocate the cache and check for error
-	cache = malloc(sizeof(cache_set_t) * S);
-    if (cache == NULL) {
+	c->sets = malloc(sizeof(cache_set_t) * c->S);
+    if (c->sets == NULL) {
         printf("Error allocating memory");
         exit(1);
     }
 
-	// Allocate lines for each set in cache
-	for (int x = 0; x < S; x++) {
-        
-        // E = number of lines per set
-		cache[x] = malloc(sizeof(cache_line_t) * E);
-
-		// ADD A CHECK FOR CACHE[i] == NULL HERE!!!!
-        if (cache[x] == NULL) {
-            printf("Eror allocating memory");
-            exit(1);
+	// Allocate the lines of all sets as one zeroed array, so every line
+	// starts out invalid with a zero tag, LRU counter and timestamps.
+	c->lines = alloc_lines((size_t) c->S * c->E, &c->backing);
+    if (c->lines == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
 
-        }    
+	// E = number of lines per set
+	for (int x = 0; x < c->S; x++) {
+		c->sets[x] = c->lines + (size_t) x * c->E;
+	}
 
-		// Set bits to 0 in each line as we are initializing
-		for (int y = 0; y < E; y++) {
-				cache[x][y].valid = 0;
-				cache[x][y].tag = 0;
-				cache[x][y].lru_counter = 0;
+	// Filters of about four counters per line, and empty recency lists
+	c->bloom = NULL;
+	if (c->use_bloom) {
+		size_t lines = (size_t) c->S * c->E;
+		c->bloom_bits = 4;
+		while ((1 << c->bloom_bits) < 4 * c->E) {
+			c->bloom_bits++;
 		}
-
+		c->bloom = calloc((size_t) c->S << c->bloom_bits, 1);
+		c->lru_prev = malloc(sizeof(int) * lines);
+		c->lru_next = malloc(sizeof(int) * lines);
+		c->lru_head = malloc(sizeof(int) * c->S);
+		c->lru_tail = malloc(sizeof(int) * c->S);
+		c->lru_used = calloc(c->S, sizeof(int));
+		if (c->bloom == NULL || c->lru_prev == NULL || c->lru_next == NULL ||
+				c->lru_head == NULL || c->lru_tail == NULL || c->lru_used == NULL) {
+			printf("Error allocating memory");
+			exit(1);
+		}
+		memset(c->lru_prev, 0xff, sizeof(int) * lines);
+		memset(c->lru_next, 0xff, sizeof(int) * lines);
+		memset(c->lru_head, 0xff, sizeof(int) * c->S);
+		memset(c->lru_tail, 0xff, sizeof(int) * c->S);
 	}
      
 }
@@ -113,178 +579,6935 @@ void init_cache() {
  * free_cache:
  * Frees all heap allocated memory used by the cache.
  */                    
-void free_cache() {
+void free_cache(cache_t* c) {
 
-	// Free the sets
-	for (int x = 0; x < S; x++) {
-        free(cache[x]);
-    }
+	// Free the lines of all sets
+    free_lines(c->lines, (size_t) c->S * c->E, c->backing);
 
 	// Now we can free the cache and pointers
-    free(cache);         
+    free(c->sets);         
+    free(c->vc_blocks);
+    if (c->bloom != NULL) {
+        free(c->bloom);
+        free(c->lru_prev);
+        free(c->lru_next);
+        free(c->lru_head);
+        free(c->lru_tail);
+        free(c->lru_used);
+        c->bloom = NULL;
+    }
+    c->sets = NULL;
+    c->lines = NULL;
+    c->vc_blocks = NULL;
 }
 
 
 /* 
- * access_data:
- * Simulates data access at given "addr" memory address in the cache.
- *
- * If already in cache, increment hit_cnt
- * If not in cache, cache it (set tag), increment miss_cnt
- * If a line is evicted, increment evict_cnt
+ * free_duel:
+ * Frees the set dueling state of cache c. It outlives free_cache() so the
+ * summary can still report it.
  */                    
-void access_data(mem_addr_t addr) {
-    
-    // Set the masks for index and tag extraction
-    int idxMask = (1 << s) - 1;
-    int cacheIndex = (addr >> b) & idxMask;
-    unsigned long long tag = addr >> (s + b); 
+void free_duel(cache_t* c) {
+    if (c->duel != NULL) {
+        free(c->duel->timeline);
+        free(c->duel);
+        c->duel = NULL;
+    }
+}
 
-    cache_set_t currentSet = cache[cacheIndex];
 
-    // Create the tracking variables for the loop
-    int isHit = 0;
-    int maxLRU = -1;
-    int replaceID = -1;
-    int firstEmptyID = -1; 
+/* 
+ * fast_mod:
+ * Returns n % d using a precomputed recip = ~0 / d, i.e. a multiply-high
+ * and at most two corrections instead of a 64-bit division.
+ */                    
+mem_addr_t fast_mod(mem_addr_t n, mem_addr_t d, mem_addr_t recip) {
+    mem_addr_t q = (mem_addr_t) (((unsigned __int128) n * recip) >> 64);
+    mem_addr_t r = n - q * d;
 
-    // Process each line in the set
-    for (int i = 0; i < E; i++) {
-        if (currentSet[i].valid) {
-            currentSet[i].lru_counter++;
-            if (currentSet[i].tag == tag) {
-                
-                
-                // Increment hit count and set variables
-                hit_cnt++;
-                isHit = 1;
-                currentSet[i].lru_counter = 0;
-            }
-            
-            // Keep track of LRU 
-            if (currentSet[i].lru_counter > maxLRU) {
-                maxLRU = currentSet[i].lru_counter;
-                replaceID = i;
+    while (r >= d) {
+        r -= d;
+    }
+    return r;
+}
+
+/* 
+ * xor_fold:
+ * XORs together consecutive "bits"-wide chunks of x.
+ */                    
+mem_addr_t xor_fold(mem_addr_t x, int bits) {
+    mem_addr_t folded = 0;
+
+    if (bits == 0) {
+        return 0;
+    }
+    while (x) {
+        folded ^= x & ((1ULL << bits) - 1);
+        x >>= bits;
+    }
+    return folded;
+}
+
+//Slice selection masks of Intel's complex addressing (Maurice et al.,
+//RAID 2015): slice bit i is the parity of the physical address AND mask i.
+mem_addr_t complex_masks[3] = {0x1B5F575440ULL, 0x2EB5FAA880ULL, 0x3CCCC93100ULL};
+
+/* 
+ * cache_index:
+ * Maps a block address to its global set number (slice * slice_sets + set)
+ * using the cache's index function:
+ *   INDEX_MASK     low block bits select the set, the next bits the slice
+ *   INDEX_XOR      XOR-fold of the whole block address for set and slice
+ *   INDEX_COMPLEX  Intel-style parity matrix for the slice, low bits for set
+ *   INDEX_MOD      block address modulo the total number of sets
+ * Set and slice counts need not be powers of two; those reduce with
+ * fast_mod() instead of a mask.
+ */                    
+int cache_index(cache_t* c, mem_addr_t block) {
+    mem_addr_t set;
+    mem_addr_t slice = 0;
+    int pow2_sets = (c->slice_sets & (c->slice_sets - 1)) == 0;
+    int pow2_slices = (c->slices & (c->slices - 1)) == 0;
+
+    if (c->index_fn == INDEX_MOD) {
+        return fast_mod(block, c->S, c->all_recip);
+    }
+
+    set = c->index_fn == INDEX_XOR ? xor_fold(block, c->set_bits) : block;
+    set = pow2_sets ? set & (c->slice_sets - 1) : fast_mod(set, c->slice_sets, c->set_recip);
+    if (c->slices == 1) {
+        return set;
+    }
+
+    if (c->index_fn == INDEX_COMPLEX && pow2_slices && c->slices <= 8) {
+        mem_addr_t paddr = block << c->b;
+        for (int i = 0; (1 << i) < c->slices; i++) {
+            slice |= (mem_addr_t) __builtin_parityll(paddr & complex_masks[i]) << i;
+        }
+    } else {
+        mem_addr_t upper = block >> c->set_bits;
+        if (c->index_fn == INDEX_COMPLEX) {
+            //No published matrix for this slice count: hash, then reduce.
+            upper = block * 0x9E3779B97F4A7C15ULL;
+            upper ^= upper >> 29;
+        } else if (c->index_fn == INDEX_XOR) {
+            upper = xor_fold(upper, c->set_bits ? c->set_bits : 8);
+        }
+        slice = pow2_slices ? upper & (c->slices - 1) : fast_mod(upper, c->slices, c->slice_recip);
+    }
+    return slice * c->slice_sets + set;
+}
+
+
+/* 
+ * log2_bucket:
+ * Returns the histogram bucket of v: 0 for 0, else floor(log2(v)) + 1,
+ * capped at REUSE_BUCKETS - 1.
+ */                    
+int log2_bucket(long v) {
+    int bucket = v > 0 ? 64 - __builtin_clzll(v) : 0;
+    return bucket < REUSE_BUCKETS ? bucket : REUSE_BUCKETS - 1;
+}
+
+/* 
+ * reuse_record:
+ * Adds a line that leaves the cache (evicted, or resident at the end when
+ * "resident" is set) to the reuse statistics of cache c.
+ */                    
+void reuse_record(cache_t* c, cache_line_t* line, int resident) {
+    reuse_stats_t* r = c->reuse;
+
+    if (resident) {
+        r->resident++;
+        r->resident_dead += line->hit_count == 0;
+        return;
+    }
+    r->evicted++;
+    r->dead += line->hit_count == 0;
+    r->total_hits += line->hit_count;
+    r->lifetime[log2_bucket(c->clock - line->insert_time)]++;
+    r->dead_time[log2_bucket(c->clock - line->last_touch)]++;
+    r->hits_per_fill[log2_bucket(line->hit_count)]++;
+}
+
+/* 
+ * reuse_flush:
+ * Counts the lines still resident at the end of the run. Call before
+ * free_cache().
+ */                    
+void reuse_flush(cache_t* c) {
+    if (c->reuse == NULL) {
+        return;
+    }
+    for (int x = 0; x < c->S; x++) {
+        for (int y = 0; y < c->E; y++) {
+            if (c->sets[x][y].valid) {
+                reuse_record(c, &c->sets[x][y], 1);
             }
-        } else if (firstEmptyID == -1) {
-            firstEmptyID = i;
         }
     }
+}
 
-    // Increase the miss count variable if no hit found
-    if (!isHit) {
-        miss_cnt++;
 
-        // Determine the target index for a new or an evicted line
-        int targetIdx = (firstEmptyID != -1) ? firstEmptyID : replaceID;
-        if (currentSet[targetIdx].valid) {
-            evict_cnt++;
+/* 
+ * vc_find:
+ * Returns the position of block in the side buffer, or -1.
+ */                    
+int vc_find(cache_t* c, mem_addr_t block) {
+    for (int i = 0; i < c->vc_used; i++) {
+        if (c->vc_blocks[i] == block) {
+            return i;
         }
+    }
+    return -1;
+}
+
+/* 
+ * vc_remove:
+ * Removes the entry at position i of the side buffer.
+ */                    
+void vc_remove(cache_t* c, int i) {
+    memmove(&c->vc_blocks[i], &c->vc_blocks[i + 1],
+            sizeof(mem_addr_t) * (c->vc_used - i - 1));
+    c->vc_used--;
+}
 
-        // Insert a new line into currentSet
-        currentSet[targetIdx].valid = 1;
-        currentSet[targetIdx].tag = tag;
-        currentSet[targetIdx].lru_counter = 0;
+/* 
+ * vc_insert:
+ * Puts block at the MRU end of the side buffer, dropping its LRU entry
+ * when the buffer is full.
+ */                    
+void vc_insert(cache_t* c, mem_addr_t block) {
+    if (c->vc_used == c->vc_size) {
+        c->vc_used--;
+        c->vc_evict_cnt++;
     }
+    memmove(&c->vc_blocks[1], &c->vc_blocks[0], sizeof(mem_addr_t) * c->vc_used);
+    c->vc_blocks[0] = block;
+    c->vc_used++;
+    c->vc_insert_cnt++;
 }
 
 /* 
- * replay_trace:
- * Replays the given trace file against the cache.
+ * vc_miss:
+ * Extends the eviction path with the fully-associative side buffer, after
+ * block missed in the cache and possibly displaced "victim".
  *
- * Reads the input trace file line by line.
- * Extracts the type of each memory access : L/S/M
- * TRANSLATE each "L" as a load i.e. 1 memory access
- * TRANSLATE each "S" as a store i.e. 1 memory access
- * TRANSLATE each "M" as a load followed by a store i.e. 2 memory accesses 
+ * Victim cache: a hit swaps the block out of the buffer while the victim
+ * takes its place; otherwise the victim is buffered.
+ * Miss cache (Jouppi): every missing block is also buffered, and a hit
+ * just refreshes it; victims of the cache are dropped.
+ * Returns ACCESS_VC_HIT if the buffer held block.
  */                    
-void replay_trace(char* trace_fn) {           
-	char buf[1000];  
-	mem_addr_t addr = 0;
-	unsigned int len = 0;
-	FILE* trace_fp = fopen(trace_fn, "r"); 
+int vc_miss(cache_t* c, mem_addr_t block, int evicted, mem_addr_t victim) {
+    int pos = vc_find(c, block);
 
-	if (!trace_fp) { 
-		fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
-		exit(1);   
-	}
+    if (pos >= 0) {
+        c->vc_hit_cnt++;
+    }
 
-	while (fgets(buf, 1000, trace_fp) != NULL) {
-		if (buf[1] == 'S' || buf[1] == 'L' || buf[1] == 'M') {
-			sscanf(buf+3, "%llx,%u", &addr, &len);
+    if (c->vc_kind == VC_VICTIM) {
+        if (pos >= 0) {
+            vc_remove(c, pos);
+        }
+        if (evicted) {
+            vc_insert(c, victim);
+        }
+    } else {
+        if (pos >= 0) {
+            //Refresh: move the entry to the MRU end.
+            memmove(&c->vc_blocks[1], &c->vc_blocks[0], sizeof(mem_addr_t) * pos);
+            c->vc_blocks[0] = block;
+        } else {
+            vc_insert(c, block);
+        }
+    }
+    return pos >= 0 ? ACCESS_VC_HIT : 0;
+}
 
-			if (verbosity)
-				printf("%c %llx,%u ", buf[1], addr, len);
 
-			// TODO - MISSING CODE
-            access_data(addr);
-            if(buf[1] == 'M'){
-                access_data(addr);
-            }
-			
-			if (verbosity)
-				printf("\n");
-		}
-	}
+/* 
+ * duel_role:
+ * Returns whether set "set" is a leader of policy A (DUEL_A) or B
+ * (DUEL_B), or a follower (DUEL_FOLLOWER). Leaders are spread evenly:
+ * one of each per constituency of duel_stride sets.
+ */                    
+int duel_role(cache_t* c, int set) {
+    int pos = set % c->duel->stride;
 
-	fclose(trace_fp);
-}  
+    if (pos == 0) {
+        return DUEL_A;
+    }
+    return pos == c->duel->stride / 2 ? DUEL_B : DUEL_FOLLOWER;
+}
 
+/* 
+ * miss_policy:
+ * Returns the policy that fills the line after a miss in set "set". For
+ * DIP and DRRIP the leader sets always use their own policy and train the
+ * PSEL counter with their misses; the followers use whichever component
+ * policy has missed less so far.
+ */                    
+int miss_policy(cache_t* c, int set) {
+    duel_t* d = c->duel;
 
-/*
- * print_usage:
- * Print information on how to use csim to standard output.
+    if (d == NULL) {
+        return c->policy;
+    }
+    int role = duel_role(c, set);
+    if (role == DUEL_A) {
+        d->leader_miss[0]++;
+        d->psel += d->psel < PSEL_MAX;
+        return d->policy[0];
+    }
+    if (role == DUEL_B) {
+        d->leader_miss[1]++;
+        d->psel -= d->psel > 0;
+        return d->policy[1];
+    }
+    int winner = d->psel > PSEL_MAX / 2;
+    d->follower_miss[winner]++;
+    return d->policy[winner];
+}
+
+/* 
+ * duel_epoch:
+ * Ends an epoch of a dueling cache: records which component policy the
+ * followers use now, extending the last run of the timeline if it is the
+ * same one.
  */                    
-void print_usage(char* argv[]) {                 
-	printf("Usage: %s [-hv] -s <num> -E <num> -b <num> -t <file>\n", argv[0]);
-	printf("Options:\n");
-	printf("  -h         Print this help message.\n");
-	printf("  -v         Verbose flag.\n");
-	printf("  -s <num>   Number of s bits for set index.\n");
-	printf("  -E <num>   Number of lines per set.\n");
-	printf("  -b <num>   Number of b bits for word and byte offsets.\n");
-	printf("  -t <file>  Trace file.\n");
-	printf("\nExamples:\n");
-	printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", argv[0]);
-	printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", argv[0]);
-	exit(0);
-}  
+void duel_epoch(cache_t* c) {
+    duel_t* d = c->duel;
+    int winner = d->psel > PSEL_MAX / 2;
 
+    d->epoch_left = d->epoch_len;
+    d->epochs_won[winner]++;
+    if (d->runs > 0 && d->timeline[d->runs - 1].winner == winner) {
+        d->timeline[d->runs - 1].epochs++;
+        return;
+    }
+    if (d->runs == d->runs_cap) {
+        d->runs_cap = d->runs_cap ? d->runs_cap * 2 : 16;
+        d->timeline = realloc(d->timeline, sizeof(duel_run_t) * d->runs_cap);
+        if (d->timeline == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+    d->timeline[d->runs].winner = winner;
+    d->timeline[d->runs].epochs = 1;
+    d->runs++;
+}
 
-/*
- * print_summary:
- * Prints a summary of the cache simulation statistics to a file.
+/* 
+ * skip_hits:
+ * Credits n accesses that are known to hit without simulating them: they
+ * count as hits, advance the clock, and close the dueling epochs they
+ * span. Hits leave PSEL alone, so every epoch closed here has the winner
+ * of the first one.
  */                    
-void print_summary(int hits, int misses, int evictions) {                
-	printf("hits:%d misses:%d evictions:%d\n", hits, misses, evictions);
-	FILE* output_fp = fopen(".csim_results", "w");
-	assert(output_fp);
-	fprintf(output_fp, "%d %d %d\n", hits, misses, evictions);
-	fclose(output_fp);
-}  
+void skip_hits(cache_t* c, long n) {
+    duel_t* d = c->duel;
 
+    c->hit_cnt += n;
+    c->clock += n;
+    if (d == NULL || n < d->epoch_left) {
+        if (d != NULL) {
+            d->epoch_left -= n;
+        }
+        return;
+    }
+    n -= d->epoch_left;
+    duel_epoch(c);
+    long epochs = n / d->epoch_len;
+    d->epochs_won[d->timeline[d->runs - 1].winner] += epochs;
+    d->timeline[d->runs - 1].epochs += epochs;
+    d->epoch_left -= n % d->epoch_len;
+}
 
-/*
- * main:
- * Main parses command line args, makes the cache, replays the memory accesses
- * free the cache and print the summary statistics.  
+/* 
+ * rrip_victim:
+ * Returns the RRIP victim of a full set: the first line with a distant
+ * re-reference prediction, after ageing the whole set until there is one.
  */                    
-int main(int argc, char* argv[]) {                      
-	char* trace_file = NULL;
-	char c;
+int rrip_victim(cache_set_t set, int E) {
+    int max = 0;
+    int victim = 0;
 
-	// Parse the command line arguments: -h, -v, -s, -E, -b, -t 
-	while ((c = getopt(argc, argv, "s:E:b:t:vh")) != -1) {
+    for (int i = 0; i < E; i++) {
+        if (set[i].rrpv > max) {
+            max = set[i].rrpv;
+            victim = i;
+        }
+    }
+    if (max < RRPV_MAX) {
+        for (int i = 0; i < E; i++) {
+            set[i].rrpv += RRPV_MAX - max;
+        }
+    }
+    return victim;
+}
+
+/* 
+ * bimodal:
+ * Returns 1 for the rare insertions of BIP and BRRIP that are made like
+ * LRU and SRRIP would (every BIP_EPSILON-th one; deterministic, so runs
+ * are reproducible).
+ */                    
+int bimodal(cache_t* c) {
+    return c->bip_count++ % BIP_EPSILON == 0;
+}
+
+
+/* 
+ * bloom_slots:
+ * Returns the two counters of a tag in the counting Bloom filter of a set.
+ */                    
+void bloom_slots(cache_t* c, int set, unsigned long long tag, unsigned char** x,
+        unsigned char** y) {
+    unsigned char* f = c->bloom + ((size_t) set << c->bloom_bits);
+    mem_addr_t h = (tag + 1) * 0x9E3779B97F4A7C15ULL;
+
+    *x = f + (h >> (64 - c->bloom_bits));
+    *y = f + ((h >> 20) & ((1ULL << c->bloom_bits) - 1));
+}
+
+/* 
+ * bloom_add:
+ * Counts a tag into the filter of a set. Saturated counters stick, so the
+ * filter can report false positives but never a false negative.
+ */                    
+void bloom_add(cache_t* c, int set, unsigned long long tag) {
+    unsigned char *x, *y;
+
+    bloom_slots(c, set, tag, &x, &y);
+    *x += *x < 255;
+    *y += *y < 255;
+}
+
+/* 
+ * bloom_remove:
+ * Removes a tag that was added with bloom_add().
+ */                    
+void bloom_remove(cache_t* c, int set, unsigned long long tag) {
+    unsigned char *x, *y;
+
+    bloom_slots(c, set, tag, &x, &y);
+    *x -= *x < 255;
+    *y -= *y < 255;
+}
+
+/* 
+ * bloom_may_contain:
+ * Returns 0 if the set certainly does not hold tag.
+ */                    
+int bloom_may_contain(cache_t* c, int set, unsigned long long tag) {
+    unsigned char *x, *y;
+
+    bloom_slots(c, set, tag, &x, &y);
+    return *x && *y;
+}
+
+/* 
+ * lru_touch:
+ * Moves line "way" of a set to the front (MRU end) of its recency list.
+ */                    
+void lru_touch(cache_t* c, int set, int way) {
+    size_t base = (size_t) set * c->E;
+    int* prev = c->lru_prev + base;
+    int* next = c->lru_next + base;
+
+    if (c->lru_head[set] == way) {
+        return;
+    }
+    if (prev[way] >= 0) {
+        next[prev[way]] = next[way];
+        if (next[way] >= 0) {
+            prev[next[way]] = prev[way];
+        } else {
+            c->lru_tail[set] = prev[way];
+        }
+    }
+    prev[way] = -1;
+    next[way] = c->lru_head[set];
+    if (c->lru_head[set] >= 0) {
+        prev[c->lru_head[set]] = way;
+    }
+    c->lru_head[set] = way;
+    if (c->lru_tail[set] < 0) {
+        c->lru_tail[set] = way;
+    }
+}
+
+/* 
+ * bloom_access:
+ * cache_access() for LRU caches with --bloom. A per-set counting Bloom
+ * filter rules out most misses without scanning the tags, and a recency
+ * list per set finds the LRU line in O(1) instead of ageing every line.
+ * Lines are only ever filled in way order and never invalidated, and the
+ * age counters of cache_access() are all distinct, so both engines pick
+ * the same victims and give exactly the same results.
+ */                    
+int bloom_access(cache_t* c, int set, unsigned long long tag, mem_addr_t block) {
+    cache_set_t lines = c->lines + (size_t) set * c->E;
+    int used = c->lru_used[set];
+
+    c->clock++;
+    if (bloom_may_contain(c, set, tag)) {
+        for (int i = 0; i < used; i++) {
+            if (lines[i].tag == tag) {
+                c->hit_cnt++;
+                lines[i].hit_count++;
+                lines[i].last_touch = c->clock;
+                lru_touch(c, set, i);
+                return ACCESS_HIT;
+            }
+        }
+    }
+
+    int result = ACCESS_MISS;
+    int way = used;
+    c->miss_cnt++;
+    if (used < c->E) {
+        c->lru_used[set]++;
+    } else {
+        way = c->lru_tail[set];
+        c->evict_cnt++;
+        result |= ACCESS_EVICT;
+        if (c->reuse != NULL) {
+            reuse_record(c, &lines[way], 0);
+        }
+        bloom_remove(c, set, lines[way].tag);
+    }
+
+    if (c->vc_kind != VC_NONE) {
+        mem_addr_t victim = lines[way].tag;
+        if (c->plain_index) {
+            victim = (victim << c->s) | set;
+        }
+        result |= vc_miss(c, block, result & ACCESS_EVICT, victim);
+    }
+
+    lines[way].valid = 1;
+    lines[way].tag = tag;
+    lines[way].hit_count = 0;
+    lines[way].insert_time = c->clock;
+    lines[way].last_touch = c->clock;
+    bloom_add(c, set, tag);
+    lru_touch(c, set, way);
+    return result;
+}
+
+
+/* 
+ * find_policy:
+ * Returns the POLICY_* number of a policy name, or -1.
+ */                    
+int find_policy(const char* name) {
+    for (int i = 0; i < NUM_POLICIES; i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/* 
+ * compressed_segs:
+ * Returns the compressed size of a block in segments. Traces carry no
+ * data, so sizes are drawn from a hash of the block address, uniformly
+ * around COMPRESS_SEGS / compress_ratio (a fixed size for each block).
+ */                    
+int compressed_segs(cache_t* c, mem_addr_t block) {
+    unsigned long long h = (block + 1) * 0x9E3779B97F4A7C15ULL;
+    double u = (h >> 11) * (1.0 / 9007199254740992.0);
+    int segs = (int) (COMPRESS_SEGS / c->compress_ratio * (0.5 + u) + 0.5);
+
+    return segs < 1 ? 1 : segs > COMPRESS_SEGS ? COMPRESS_SEGS : segs;
+}
+
+/* 
+ * line_segs:
+ * Returns the space of a line of the given block in a compressed set:
+ * its compressed size, scaled by the share of valid sectors.
+ */                    
+int line_segs(cache_t* c, cache_line_t* line, mem_addr_t block) {
+    int segs = compressed_segs(c, block);
+    int n = 1 << c->sector_bits;
+
+    if (c->sector_bits == 0) {
+        return segs;
+    }
+    return (segs * __builtin_popcountll(line->sector_valid) + n - 1) / n;
+}
+
+/* 
+ * evict_line:
+ * Counts the eviction of a valid line of set "index" and records it as the
+ * last victim (victim_block, victim_hits, victim_dirty) and for --reuse.
+ */                    
+void evict_line(cache_t* c, cache_line_t* line, int index) {
+    c->evict_cnt++;
+    c->victim_block = c->plain_index ? (line->tag << c->s) | index : line->tag;
+    c->victim_hits = line->hit_count;
+    c->victim_dirty = line->dirty;
+    if (c->reuse != NULL) {
+        reuse_record(c, line, 0);
+    }
+}
+
+/* 
+ * make_room:
+ * Evicts the least recently used lines of a compressed set "index", other
+ * than line "keep", until keep's segs fit into the data space of the set.
+ * Evicted lines go to the victim buffer like capacity victims do.
+ * Returns ACCESS_EVICT if any line was evicted.
+ */                    
+int make_room(cache_t* c, cache_set_t set, int keep, int index) {
+    int used = 0;
+    int result = 0;
+
+    for (int i = 0; i < c->E; i++) {
+        if (set[i].valid) {
+            used += set[i].segs;
+        }
+    }
+    while (used > c->data_ways * COMPRESS_SEGS) {
+        int victim = -1;
+        for (int i = 0; i < c->E; i++) {
+            if (set[i].valid && i != keep &&
+                    (victim < 0 || set[i].lru_counter > set[victim].lru_counter)) {
+                victim = i;
+            }
+        }
+        set[victim].valid = 0;
+        used -= set[victim].segs;
+        evict_line(c, &set[victim], index);
+        c->space_evict_cnt++;
+        if (c->vc_kind == VC_VICTIM) {
+            vc_insert(c, c->victim_block);
+        }
+        result = ACCESS_EVICT;
+    }
+    return result;
+}
+
+/* 
+ * cache_access:
+ * Simulates data access at given "addr" memory address in cache c.
+ *
+ * If already in cache, increment hit_cnt
+ * If not in cache, cache it (set tag), increment miss_cnt
+ * If a line is evicted, increment evict_cnt
+ * Misses also consult the victim or miss cache, if one is attached.
+ * Returns the ACCESS_* flags describing what happened.
+ */                    
+int cache_access(cache_t* c, mem_addr_t addr) {
+    
+    // Set the masks for index and tag extraction
+    mem_addr_t block = addr >> c->b;
+    int cacheIndex;
+    unsigned long long tag;
+
+    if (c->plain_index) {
+        cacheIndex = block & ((1ULL << c->s) - 1);
+        tag = block >> c->s;
+    } else {
+        cacheIndex = cache_index(c, block);
+        tag = block;
+    }
+
+    if (c->bloom != NULL) {
+        return bloom_access(c, cacheIndex, tag, block);
+    }
+
+    cache_set_t currentSet = c->lines + (size_t) cacheIndex * c->E;
+
+    c->clock++;
+    if (c->duel != NULL && --c->duel->epoch_left == 0) {
+        duel_epoch(c);
+    }
+
+    // Create the tracking variables for the loop
+    int isHit = 0;
+    int hitID = -1;
+    int maxLRU = -1;
+    int replaceID = -1;
+    int firstEmptyID = -1; 
+
+    // Process each line in the set
+    for (int i = 0; i < c->E; i++) {
+        if (currentSet[i].valid) {
+            currentSet[i].lru_counter++;
+            if (currentSet[i].tag == tag) {
+                
+                
+                // Set the hit variables, counted below
+                isHit = 1;
+                hitID = i;
+                currentSet[i].lru_counter = 0;
+                currentSet[i].rrpv = 0;
+                currentSet[i].hit_count++;
+                currentSet[i].last_touch = c->clock;
+            }
+            
+            // Keep track of LRU 
+            if (currentSet[i].lru_counter > maxLRU) {
+                maxLRU = currentSet[i].lru_counter;
+                replaceID = i;
+            }
+        } else if (firstEmptyID == -1) {
+            firstEmptyID = i;
+        }
+    }
+
+    //With sectors, a resident tag hits only if the sector was filled too.
+    unsigned long long sector = c->sector_bits ?
+        1ULL << ((addr >> (c->b - c->sector_bits)) & ((1 << c->sector_bits) - 1)) : 0;
+    if (isHit && (currentSet[hitID].sector_valid & sector) != sector) {
+        c->miss_cnt++;
+        c->sector_miss_cnt++;
+        currentSet[hitID].sector_valid |= sector;
+        currentSet[hitID].dirty |= c->store;
+        if (c->compress_ratio > 0.0) {
+            currentSet[hitID].segs = line_segs(c, &currentSet[hitID], block);
+            return ACCESS_MISS | ACCESS_SECTOR_MISS |
+                make_room(c, currentSet, hitID, cacheIndex);
+        }
+        return ACCESS_MISS | ACCESS_SECTOR_MISS;
+    }
+    if (isHit) {
+        c->hit_cnt++;
+        currentSet[hitID].dirty |= c->store;
+        return ACCESS_HIT;
+    }
+
+    // Increase the miss count variable if no hit found
+    int result = ACCESS_MISS;
+    c->miss_cnt++;
+
+    // Determine the target index for a new or an evicted line
+    int policy = c->policy == POLICY_LRU ? POLICY_LRU : miss_policy(c, cacheIndex);
+    int rrip = policy >= POLICY_SRRIP;
+    int targetIdx = (firstEmptyID != -1) ? firstEmptyID :
+        rrip ? rrip_victim(currentSet, c->E) : replaceID;
+    if (currentSet[targetIdx].valid) {
+        result |= ACCESS_EVICT;
+        evict_line(c, &currentSet[targetIdx], cacheIndex);
+    }
+
+    if (c->vc_kind != VC_NONE) {
+        mem_addr_t victim = currentSet[targetIdx].tag;
+        if (c->plain_index) {
+            victim = (victim << c->s) | cacheIndex;
+        }
+        result |= vc_miss(c, block, result & ACCESS_EVICT, victim);
+    }
+
+    // Insert a new line into currentSet
+    currentSet[targetIdx].valid = 1;
+    currentSet[targetIdx].tag = tag;
+    currentSet[targetIdx].lru_counter = 0;
+    currentSet[targetIdx].rrpv = RRPV_MAX - 1;
+    if (policy == POLICY_LIP || (policy == POLICY_BIP && !bimodal(c))) {
+        //Insert at the LRU position: older than every other line.
+        currentSet[targetIdx].lru_counter = maxLRU + 1;
+    } else if (policy == POLICY_BRRIP && !bimodal(c)) {
+        currentSet[targetIdx].rrpv = RRPV_MAX;
+    }
+    currentSet[targetIdx].hit_count = 0;
+    currentSet[targetIdx].insert_time = c->clock;
+    currentSet[targetIdx].last_touch = c->clock;
+    currentSet[targetIdx].sector_valid = sector;
+    currentSet[targetIdx].dirty = c->store;
+    if (c->compress_ratio > 0.0) {
+        currentSet[targetIdx].segs = line_segs(c, &currentSet[targetIdx], block);
+        c->fill_segs += compressed_segs(c, block);
+        result |= make_room(c, currentSet, targetIdx, cacheIndex);
+    }
+    return result;
+}
+
+/* 
+ * free_levels:
+ * Frees the L1I and L2 of split I/D mode, if they were allocated.
+ */                    
+void free_levels() {
+    if (split_i) {
+        free_cache(&icache);
+    }
+    if (use_l2) {
+        free_cache(&l2cache);
+    }
+}
+
+/* 
+ * l2_stream_access:
+ * Forwards an L1 miss of the given stream to the shared L2 and counts the
+ * outcome per stream. Returns ACCESS_L2_HIT on a hit.
+ */                    
+int l2_stream_access(int stream, mem_addr_t addr) {
+    if (cache_access(&l2cache, addr) & ACCESS_HIT) {
+        l2_stream_hits[stream]++;
+        return ACCESS_L2_HIT;
+    }
+    l2_stream_misses[stream]++;
+    return 0;
+}
+
+/* 
+ * access_data:
+ * Simulates a data access at "addr" in the simulated (L1D) cache. Misses
+ * not served by the victim buffer continue to the shared L2 if there is
+ * one. Returns the L1 outcome.
+ */                    
+int access_data(mem_addr_t addr) {
+    int result = cache_access(&cache, addr);
+
+    if (!(result & (ACCESS_HIT | ACCESS_VC_HIT)) && use_l2) {
+        result |= l2_stream_access(STREAM_DATA, addr);
+    }
+    return result;
+}
+
+/* 
+ * access_inst:
+ * Simulates an instruction fetch at "addr" in the L1I cache, continuing
+ * to the shared L2 on a miss (unless the victim buffer served it).
+ * Returns the L1 outcome.
+ */                    
+int access_inst(mem_addr_t addr) {
+    int result = cache_access(&icache, addr);
+
+    if (!(result & (ACCESS_HIT | ACCESS_VC_HIT)) && use_l2) {
+        result |= l2_stream_access(STREAM_INST, addr);
+    }
+    return result;
+}
+
+
+//Globals for the page-mapping layer in front of access_data() (--page-map).
+enum { MAP_IDENTITY, MAP_RANDOM, MAP_COLOR, MAP_PAGEMAP };
+int page_map = MAP_IDENTITY; //how virtual pages are placed in physical memory
+int page_shift = 12; //log2 of the page size
+unsigned long long phys_frames = 1ULL << 22; //physical memory size in pages
+
+//Type page_entry_t: One virtual-to-physical page translation.
+typedef struct page_entry {
+    mem_addr_t vpn;
+    mem_addr_t pfn;
+} page_entry_t;
+
+//Open-addressing table of the pages translated so far (vpn == ~0 is empty).
+page_entry_t* page_table = NULL;
+size_t page_table_cap = 0;
+size_t page_table_used = 0;
+
+mem_addr_t next_frame = 0; //allocation counter for MAP_RANDOM
+mem_addr_t num_colors = 1; //page colors of the simulated cache
+mem_addr_t* color_next = NULL; //per-color allocation counters for MAP_COLOR
+
+//Raw /proc/pid/pagemap entries for MAP_PAGEMAP, starting at pagemap_base.
+unsigned long long* pagemap = NULL;
+size_t pagemap_len = 0;
+mem_addr_t pagemap_base = 0; //first virtual page number covered by the dump
+unsigned char* pagemap_frames = NULL; //bitmap of the frames the dump hands out
+
+//Bits 0-54 of a pagemap entry hold the frame number, bit 63 is "present".
+#define PAGEMAP_PFN(ent) ((ent) & ((1ULL << 55) - 1))
+
+/* 
+ * scramble_frame:
+ * Maps a frame counter to a frame number with a bijection over the
+ * (power of two sized) physical memory, so MAP_RANDOM never hands out the
+ * same frame twice.
+ */                    
+mem_addr_t scramble_frame(mem_addr_t x) {
+    mem_addr_t mask = phys_frames - 1;
+    int half = 0;
+
+    while ((1ULL << (2 * half)) < phys_frames) {
+        half++;
+    }
+    x ^= gen_seed & mask;
+    x = (x * 0x9E3779B97F4A7C15ULL) & mask;
+    x ^= x >> (half ? half : 1);
+    x = (x * 0xBF58476D1CE4E5B9ULL) & mask;
+    x ^= x >> (half ? half : 1);
+    return x;
+}
+
+/* 
+ * alloc_frame:
+ * Picks a physical frame for a virtual page touched for the first time.
+ */                    
+mem_addr_t alloc_frame(mem_addr_t vpn) {
+    if (page_map == MAP_PAGEMAP && vpn >= pagemap_base && vpn - pagemap_base < pagemap_len) {
+        unsigned long long ent = pagemap[vpn - pagemap_base];
+        if (ent >> 63) {
+            return PAGEMAP_PFN(ent);
+        }
+    }
+
+    if (page_map == MAP_COLOR) {
+        mem_addr_t color = vpn % num_colors;
+        mem_addr_t frame = color_next[color]++ * num_colors + color;
+        if (frame >= phys_frames) {
+            printf("Out of physical memory for page color %llu\n", color);
+            exit(1);
+        }
+        return frame;
+    }
+
+    //MAP_RANDOM, and pages missing from a pagemap dump, which must not
+    //share a frame with a page of the dump.
+    for (;;) {
+        if (next_frame >= phys_frames) {
+            printf("Out of physical memory (%llu pages)\n", phys_frames);
+            exit(1);
+        }
+        mem_addr_t frame = scramble_frame(next_frame++);
+        if (pagemap_frames == NULL || !(pagemap_frames[frame >> 3] & (1 << (frame & 7)))) {
+            return frame;
+        }
+    }
+}
+
+/* 
+ * page_table_insert:
+ * Adds a translation, doubling the table when it is half full.
+ */                    
+void page_table_insert(mem_addr_t vpn, mem_addr_t pfn) {
+    if (2 * (page_table_used + 1) > page_table_cap) {
+        page_entry_t* old = page_table;
+        size_t old_cap = page_table_cap;
+
+        page_table_cap = old_cap ? old_cap * 2 : 1024;
+        page_table = malloc(sizeof(page_entry_t) * page_table_cap);
+        if (page_table == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        memset(page_table, 0xff, sizeof(page_entry_t) * page_table_cap);
+        page_table_used = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].vpn != ~0ULL) {
+                page_table_insert(old[i].vpn, old[i].pfn);
+            }
+        }
+        free(old);
+    }
+
+    size_t i = (vpn * 0x9E3779B97F4A7C15ULL) & (page_table_cap - 1);
+    while (page_table[i].vpn != ~0ULL) {
+        i = (i + 1) & (page_table_cap - 1);
+    }
+    page_table[i].vpn = vpn;
+    page_table[i].pfn = pfn;
+    page_table_used++;
+}
+
+/* 
+ * translate_addr:
+ * Returns the physical address for a virtual trace address, allocating a
+ * frame according to page_map on the first touch of each page.
+ */                    
+mem_addr_t translate_addr(mem_addr_t addr) {
+    mem_addr_t vpn = addr >> page_shift;
+    mem_addr_t offset = addr & ((1ULL << page_shift) - 1);
+
+    if (page_table_cap) {
+        size_t i = (vpn * 0x9E3779B97F4A7C15ULL) & (page_table_cap - 1);
+        while (page_table[i].vpn != ~0ULL) {
+            if (page_table[i].vpn == vpn) {
+                return (page_table[i].pfn << page_shift) | offset;
+            }
+            i = (i + 1) & (page_table_cap - 1);
+        }
+    }
+
+    mem_addr_t pfn = alloc_frame(vpn);
+    page_table_insert(vpn, pfn);
+    return (pfn << page_shift) | offset;
+}
+
+/* 
+ * init_page_map:
+ * Parses a --page-map spec (identity, random, color or
+ * pagemap:<file>[@<hex vaddr>]) and prepares the chosen policy. Colors are
+ * derived from the simulated cache, so this runs after init_cache().
+ */                    
+void init_page_map(char* spec) {
+    //Round down to a power of two for scramble_frame().
+    phys_frames = 1ULL << (63 - __builtin_clzll(phys_frames));
+
+    if (strcmp(spec, "identity") == 0) {
+        page_map = MAP_IDENTITY;
+    } else if (strcmp(spec, "random") == 0) {
+        page_map = MAP_RANDOM;
+    } else if (strcmp(spec, "color") == 0) {
+        //One color per page-sized slice of a cache way.
+        mem_addr_t way_bytes = (mem_addr_t) cache.S * cache.B;
+        page_map = MAP_COLOR;
+        num_colors = way_bytes >> page_shift ? way_bytes >> page_shift : 1;
+        color_next = calloc(num_colors, sizeof(mem_addr_t));
+        if (color_next == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    } else if (strncmp(spec, "pagemap:", 8) == 0) {
+        char* fn = spec + 8;
+        char* at = strchr(fn, '@');
+        FILE* fp;
+        long size;
+
+        page_map = MAP_PAGEMAP;
+        if (at != NULL) {
+            *at = '\0';
+            pagemap_base = strtoull(at + 1, NULL, 16) >> page_shift;
+        }
+        fp = fopen(fn, "rb");
+        if (!fp) {
+            fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+            exit(1);
+        }
+        if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+            printf("%s: %s\n", fn, strerror(errno));
+            exit(1);
+        }
+        rewind(fp);
+        pagemap_len = size / sizeof(unsigned long long);
+        if (pagemap_len == 0) {
+            printf("%s: empty pagemap dump\n", fn);
+            exit(1);
+        }
+        pagemap = malloc(pagemap_len * sizeof(unsigned long long));
+        pagemap_frames = calloc(phys_frames / 8 + 1, 1);
+        if (pagemap == NULL || pagemap_frames == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        if (fread(pagemap, sizeof(unsigned long long), pagemap_len, fp) != pagemap_len) {
+            fprintf(stderr, "%s: short read\n", fn);
+            exit(1);
+        }
+        fclose(fp);
+
+        //Unprivileged reads of /proc/pid/pagemap (Linux 4.0+) zero the frames.
+        size_t present = 0, zero = 0;
+        for (size_t i = 0; i < pagemap_len; i++) {
+            mem_addr_t pfn = PAGEMAP_PFN(pagemap[i]);
+            if (pagemap[i] >> 63) {
+                present++;
+                zero += pfn == 0;
+                if (pfn < phys_frames) {
+                    pagemap_frames[pfn >> 3] |= 1 << (pfn & 7);
+                }
+            }
+        }
+        if (present > 0 && zero == present) {
+            printf("%s: every present page has frame 0; the dump needs CAP_SYS_ADMIN\n", fn);
+            exit(1);
+        }
+    } else {
+        printf("Unknown page map: %s\n", spec);
+        exit(1);
+    }
+}
+
+/* 
+ * free_page_map:
+ * Frees the translation table and policy state.
+ */                    
+void free_page_map() {
+    free(page_table);
+    free(color_next);
+    free(pagemap);
+    free(pagemap_frames);
+    page_table = NULL;
+    color_next = NULL;
+    pagemap = NULL;
+    pagemap_frames = NULL;
+    page_table_cap = 0;
+    page_table_used = 0;
+}
+
+
+//Type region_t: A named address range [start, end) of the region map.
+typedef struct region {
+    mem_addr_t start;
+    mem_addr_t end;
+    char* name; //while loading; names are then interned into region_stats
+    int id; //index into region_stats
+    size_t seq; //load order, later ranges win ties
+} region_t;
+
+//Type region_stats_t: The L1 outcomes of the accesses to one region name.
+//Ranges with the same name (e.g. heap blocks of one site) share one entry.
+typedef struct region_stats {
+    char* name;
+    long hits;
+    long misses;
+    long evictions;
+} region_stats_t;
+
+//Globals for per-region attribution (--regions, --elf-symbols, --heap-log).
+region_t* regions = NULL; //disjoint ranges, sorted by start
+size_t num_regions = 0;
+size_t regions_cap = 0;
+region_stats_t* region_stats = NULL; //one per name, plus "[other]" last
+int num_region_names = 0;
+int region_filter = 0; //only simulate accesses inside a region
+size_t region_last = 0; //range of the previous lookup
+
+/* 
+ * add_region:
+ * Adds the range [start, end) named "name" to the region map.
+ */                    
+void add_region(const char* name, mem_addr_t start, mem_addr_t end) {
+    if (end <= start) {
+        return;
+    }
+    if (num_regions == regions_cap) {
+        regions_cap = regions_cap ? regions_cap * 2 : 256;
+        regions = realloc(regions, sizeof(region_t) * regions_cap);
+        if (regions == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+    regions[num_regions].start = start;
+    regions[num_regions].end = end;
+    regions[num_regions].name = strdup(name);
+    regions[num_regions].id = -1;
+    regions[num_regions].seq = num_regions;
+    num_regions++;
+}
+
+/* 
+ * parse_addr:
+ * Parses the decimal or 0x hex number at *p, after blanks, into out and
+ * moves *p past it. Returns 0 if there is no unsigned number there.
+ */                    
+int parse_addr(char** p, mem_addr_t* out) {
+    char* end;
+
+    while (**p == ' ' || **p == '\t') {
+        (*p)++;
+    }
+    if (**p < '0' || **p > '9') {
+        return 0;
+    }
+    errno = 0;
+    *out = strtoull(*p, &end, 0);
+    if (errno != 0) {
+        return 0;
+    }
+    *p = end;
+    return 1;
+}
+
+/* 
+ * load_region_file:
+ * Reads a text region map. With "sized" unset each line is
+ * "<name> <start> <end>" (--regions), otherwise "<name> <addr> <size>"
+ * (--heap-log, one line per allocation). Numbers may be decimal or 0x hex;
+ * blank and "#" lines are skipped.
+ */                    
+void load_region_file(const char* path, int sized) {
+    char line[1000];
+    char name[256];
+    mem_addr_t start, end;
+    int lineno = 0;
+    FILE* fp = fopen(path, "r");
+
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if (sscanf(line, " %255s", name) != 1 || name[0] == '#') {
+            continue;
+        }
+        char* p = strstr(line, name) + strlen(name);
+        int ok = parse_addr(&p, &start) && parse_addr(&p, &end) &&
+            strchr(" \t\r\n", *p) != NULL;
+        if (ok && sized) {
+            //A zero-sized allocation covers no address.
+            if (end == 0) {
+                continue;
+            }
+            end += start;
+        }
+        if (!ok || end <= start) {
+            fprintf(stderr, "%s:%d: expected <name> <start> <%s> with a non-empty range\n",
+                    path, lineno, sized ? "size" : "end");
+            exit(1);
+        }
+        add_region(name, start, end);
+    }
+    fclose(fp);
+}
+
+/* 
+ * load_elf_symbols:
+ * Adds the sized data and function symbols of a 64-bit ELF file to the
+ * region map. "spec" is "<file>[@<hex bias>]"; the bias is added to every
+ * symbol, for position-independent executables.
+ */                    
+void load_elf_symbols(char* spec) {
+    char* at = strchr(spec, '@');
+    mem_addr_t bias = 0;
+    struct stat st;
+    int fd;
+
+    if (at != NULL) {
+        *at = '\0';
+        bias = strtoull(at + 1, NULL, 16);
+    }
+    fd = open(spec, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", spec, strerror(errno));
+        exit(1);
+    }
+    unsigned char* img = st.st_size >= (off_t) sizeof(Elf64_Ehdr) ?
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    Elf64_Ehdr* eh = (Elf64_Ehdr*) img;
+    if (img == MAP_FAILED || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+            eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+            eh->e_shoff + (mem_addr_t) eh->e_shnum * sizeof(Elf64_Shdr) > (mem_addr_t) st.st_size) {
+        printf("%s: not a 64-bit ELF file\n", spec);
+        exit(1);
+    }
+
+    //Prefer the full symbol table; stripped files only have .dynsym.
+    Elf64_Shdr* sh = (Elf64_Shdr*) (img + eh->e_shoff);
+    Elf64_Shdr* symtab = NULL;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type == SHT_SYMTAB || (sh[i].sh_type == SHT_DYNSYM && symtab == NULL)) {
+            symtab = &sh[i];
+        }
+    }
+    if (symtab == NULL || symtab->sh_link >= eh->e_shnum ||
+            symtab->sh_offset + symtab->sh_size > (mem_addr_t) st.st_size ||
+            sh[symtab->sh_link].sh_offset + sh[symtab->sh_link].sh_size > (mem_addr_t) st.st_size) {
+        printf("%s: no symbol table\n", spec);
+        exit(1);
+    }
+
+    Elf64_Sym* sym = (Elf64_Sym*) (img + symtab->sh_offset);
+    const char* names = (const char*) img + sh[symtab->sh_link].sh_offset;
+    size_t names_size = sh[symtab->sh_link].sh_size;
+    for (size_t i = 0; i < symtab->sh_size / sizeof(Elf64_Sym); i++) {
+        int type = ELF64_ST_TYPE(sym[i].st_info);
+        if ((type != STT_OBJECT && type != STT_FUNC) || sym[i].st_size == 0 ||
+                sym[i].st_shndx == SHN_UNDEF || sym[i].st_name >= names_size ||
+                memchr(names + sym[i].st_name, '\0', names_size - sym[i].st_name) == NULL) {
+            continue;
+        }
+        add_region(names + sym[i].st_name, sym[i].st_value + bias,
+                sym[i].st_value + bias + sym[i].st_size);
+    }
+    munmap(img, st.st_size);
+    close(fd);
+}
+
+/* 
+ * region_by_name:
+ * qsort() order of ranges by name.
+ */                    
+int region_by_name(const void* a, const void* b) {
+    return strcmp(((const region_t*) a)->name, ((const region_t*) b)->name);
+}
+
+/* 
+ * region_by_start:
+ * qsort() order of ranges by start, enclosing ranges before the ones
+ * they contain, and later-loaded ranges last among equals.
+ */                    
+int region_by_start(const void* a, const void* b) {
+    const region_t* x = a;
+    const region_t* y = b;
+
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+    if (x->end != y->end) {
+        return x->end > y->end ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : 1;
+}
+
+/* 
+ * finish_regions:
+ * Turns the loaded ranges into the lookup structure: names are interned
+ * into region_stats, and the ranges are flattened into disjoint pieces
+ * sorted by start, so a lookup is one binary search. Where ranges nest,
+ * the innermost one owns the address (a field inside a struct, a heap
+ * block inside an arena); a range that sticks out of an enclosing one is
+ * cut at its end.
+ */                    
+void finish_regions() {
+    if (num_regions == 0) {
+        return;
+    }
+
+    //Intern the names; sorting by name keeps this O(n log n).
+    qsort(regions, num_regions, sizeof(region_t), region_by_name);
+    region_stats = calloc(num_regions + 1, sizeof(region_stats_t));
+    if (region_stats == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    for (size_t i = 0; i < num_regions; i++) {
+        if (i == 0 || strcmp(regions[i].name, region_stats[num_region_names - 1].name) != 0) {
+            region_stats[num_region_names++].name = regions[i].name;
+        } else {
+            free(regions[i].name);
+        }
+        regions[i].id = num_region_names - 1;
+        regions[i].name = NULL;
+    }
+    region_stats[num_region_names].name = strdup("[other]");
+
+    //Flatten with a stack of the ranges that are open at "pos".
+    qsort(regions, num_regions, sizeof(region_t), region_by_start);
+    region_t* flat = malloc(sizeof(region_t) * (2 * num_regions + 1));
+    region_t* stack = malloc(sizeof(region_t) * num_regions);
+    size_t nflat = 0, depth = 0;
+    mem_addr_t pos = 0;
+    if (flat == NULL || stack == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+
+#define EMIT(from, to, owner) \
+    if ((from) < (to)) { \
+        if (nflat > 0 && flat[nflat - 1].id == (owner) && flat[nflat - 1].end == (from)) { \
+            flat[nflat - 1].end = (to); \
+        } else { \
+            flat[nflat].start = (from); \
+            flat[nflat].end = (to); \
+            flat[nflat].name = NULL; \
+            flat[nflat].id = (owner); \
+            flat[nflat].seq = nflat; \
+            nflat++; \
+        } \
+    }
+
+    for (size_t i = 0; i <= num_regions; i++) {
+        mem_addr_t next = i < num_regions ? regions[i].start : ~0ULL;
+
+        //Close the ranges that end before the next one starts.
+        while (depth > 0 && stack[depth - 1].end <= next) {
+            EMIT(pos, stack[depth - 1].end, stack[depth - 1].id);
+            if (stack[depth - 1].end > pos) {
+                pos = stack[depth - 1].end;
+            }
+            depth--;
+        }
+        if (i == num_regions) {
+            break;
+        }
+        if (depth > 0) {
+            EMIT(pos, next, stack[depth - 1].id);
+            if (regions[i].end > stack[depth - 1].end) {
+                regions[i].end = stack[depth - 1].end;
+            }
+        }
+        pos = next;
+        stack[depth++] = regions[i];
+    }
+#undef EMIT
+
+    free(stack);
+    free(regions);
+    regions = flat;
+    num_regions = nflat;
+}
+
+/* 
+ * region_find:
+ * Returns the region_stats index of the region that contains addr, or
+ * num_region_names ("[other]") if there is none. The previous answer is
+ * tried first, since consecutive accesses mostly stay in one object.
+ */                    
+int region_find(mem_addr_t addr) {
+    region_t* r = &regions[region_last];
+    size_t lo = 0, hi = num_regions;
+
+    if (addr >= r->start && addr < r->end) {
+        return r->id;
+    }
+
+    //Find the last range that starts at or below addr.
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (regions[mid].start <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && addr < regions[lo - 1].end) {
+        region_last = lo - 1;
+        return regions[lo - 1].id;
+    }
+    return num_region_names;
+}
+
+/* 
+ * region_count:
+ * Credits the L1 outcome of one access to region "id".
+ */                    
+void region_count(int id, int result) {
+    region_stats_t* r = &region_stats[id];
+
+    if (result & ACCESS_HIT) {
+        r->hits++;
+    } else {
+        r->misses++;
+        r->evictions += (result & ACCESS_EVICT) != 0;
+    }
+}
+
+/* 
+ * free_regions:
+ * Frees the region map and the names.
+ */                    
+void free_regions() {
+    for (int i = 0; i <= num_region_names && region_stats != NULL; i++) {
+        free(region_stats[i].name);
+    }
+    free(regions);
+    free(region_stats);
+    regions = NULL;
+    region_stats = NULL;
+    num_regions = 0;
+    num_region_names = 0;
+}
+
+
+//Type mshr_t: A miss status holding register: one outstanding line fill.
+typedef struct mshr {
+    mem_addr_t block;
+    long done; //cycle the fill completes
+} mshr_t;
+
+//Globals for the timing model (--timing). Records issue in trace order,
+//issue_gap cycles apart. Hits take hit_latency cycles; misses hold an
+//MSHR until their fill returns, and a later access to a block that is
+//still being filled merges into its MSHR. When all MSHRs are busy, issue
+//stalls until one frees up. Fills take l2_latency (L2 hits) or
+//mem_latency cycles; with a bandwidth limit they also queue for the
+//memory channel, each occupying it for one line transfer.
+int timing = 0;
+int num_mshrs = 8; //--mshrs
+long issue_gap = 1; //--issue-gap
+long hit_latency = 4; //--hit-latency
+long l2_latency = 12; //--l2-latency
+long mem_latency = 200; //--mem-latency
+double mem_bandwidth = 0.0; //bytes per cycle, 0 for unlimited (--mem-bandwidth)
+mshr_t* mshrs = NULL;
+
+//Timing model state and statistics.
+long now = 0; //issue cycle of the current record
+long last_done = 0; //latest completion of any access
+long channel_free = 0; //cycle the memory channel is free again
+long timed_accesses = 0;
+long total_latency = 0; //sum of access latencies, for the AMAT
+long mshr_merges = 0; //accesses served by an outstanding fill
+long mshr_stalls = 0; //misses that found every MSHR busy
+long stall_cycles = 0; //issue cycles lost to those stalls
+long mem_requests = 0; //fills that went to memory
+long mem_cycles = 0; //sum of their latencies, including queueing
+long fill_cycles = 0; //sum of all fill latencies, for the MLP
+long busy_cycles = 0; //cycles with at least one fill outstanding
+long busy_start = 0, busy_end = 0; //current busy interval
+
+/* 
+ * init_timing:
+ * Allocates the MSHRs, all free.
+ */                    
+void init_timing() {
+    mshrs = calloc(num_mshrs, sizeof(mshr_t));
+    if (num_mshrs < 1 || mshrs == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+}
+
+/* 
+ * timing_issue:
+ * Advances the issue clock to the next trace record.
+ */                    
+void timing_issue() {
+    now += issue_gap;
+}
+
+/* 
+ * timing_access:
+ * Times one access to addr whose (L1) outcome was "result".
+ */                    
+void timing_access(mem_addr_t addr, int result) {
+    mem_addr_t block = addr >> cache.b;
+    mshr_t* free_slot = NULL;
+    long done;
+
+    timed_accesses++;
+
+    //Data that is still on its way: wait for the outstanding fill.
+    for (int i = 0; i < num_mshrs; i++) {
+        if (mshrs[i].done > now && mshrs[i].block == block) {
+            mshr_merges++;
+            total_latency += mshrs[i].done - now;
+            return;
+        }
+    }
+    if (result & (ACCESS_HIT | ACCESS_VC_HIT)) {
+        done = now + hit_latency;
+        total_latency += hit_latency;
+        if (done > last_done) {
+            last_done = done;
+        }
+        return;
+    }
+
+    //A miss needs a free MSHR; stall issue until the first one frees up.
+    for (int i = 0; i < num_mshrs; i++) {
+        if (free_slot == NULL || mshrs[i].done < free_slot->done) {
+            free_slot = &mshrs[i];
+        }
+    }
+    if (free_slot->done > now) {
+        mshr_stalls++;
+        stall_cycles += free_slot->done - now;
+        now = free_slot->done;
+    }
+
+    if (result & ACCESS_L2_HIT) {
+        done = now + l2_latency;
+    } else {
+        long start = now;
+        if (mem_bandwidth > 0.0) {
+            long transfer = (long) ceil(cache.B / mem_bandwidth);
+            if (channel_free > start) {
+                start = channel_free;
+            }
+            channel_free = start + transfer;
+            start += transfer;
+        }
+        done = start + (use_l2 ? l2_latency : 0) + mem_latency;
+        mem_requests++;
+        mem_cycles += done - now;
+    }
+    free_slot->block = block;
+    free_slot->done = done;
+    total_latency += done - now;
+    fill_cycles += done - now;
+    if (done > last_done) {
+        last_done = done;
+    }
+
+    //Fills start in issue order, so the busy time is a running union.
+    if (now >= busy_end) {
+        busy_cycles += busy_end - busy_start;
+        busy_start = now;
+        busy_end = done;
+    } else if (done > busy_end) {
+        busy_end = done;
+    }
+}
+
+/* 
+ * timing_cycles:
+ * Returns the estimated cycles of the whole trace.
+ */                    
+long timing_cycles() {
+    return last_done > now ? last_done : now;
+}
+
+/* 
+ * timing_mlp:
+ * Returns the average number of outstanding fills while there is one.
+ */                    
+double timing_mlp() {
+    long busy = busy_cycles + busy_end - busy_start;
+    return busy > 0 ? (double) fill_cycles / busy : 0.0;
+}
+
+/* 
+ * free_timing:
+ * Frees the MSHRs.
+ */                    
+void free_timing() {
+    free(mshrs);
+    mshrs = NULL;
+}
+
+//Type shards_block_t: A sampled block tracked by the SHARDS pass.
+typedef struct shards_block {
+    mem_addr_t block;
+    unsigned long long hash; //spatial hash, the sampling key
+    long last; //sample clock of the last reference, the treap key
+    int hnext; //hash chain, or free list
+    int left, right; //treap children
+    unsigned int pri; //treap heap priority
+    int size; //treap subtree size
+} shards_block_t;
+
+//Histogram buckets of scaled reuse distances: exact below 8, then 8
+//sub-buckets per power of two, so powers of two are bucket boundaries.
+#define MRC_SUB 8
+#define MRC_BUCKETS (MRC_SUB + 61 * MRC_SUB)
+
+//Globals for SHARDS sampled miss-ratio curves (--shards, --shards-max).
+//A reference is sampled when the hash of its block is at most
+//shards_threshold, i.e. at rate R = (threshold + 1) / 2^64, so a block is
+//either always or never sampled. Reuse distances between sampled
+//references, counted in distinct sampled blocks and scaled by 1/R,
+//estimate the LRU stack distances of the full trace. With a budget of
+//shards_max blocks the threshold is lowered whenever it is exceeded,
+//dropping the blocks with the largest hashes (SHARDS fixed-size).
+double shards_rate = 0.0; //initial sampling rate, 0 when off
+long shards_max = 0; //tracked block budget, 0 for unbounded
+unsigned long long shards_threshold;
+shards_block_t* shards_pool = NULL;
+int shards_pool_cap = 0;
+int shards_pool_used = 0;
+int shards_free = -1;
+int* shards_buckets = NULL;
+int shards_nbuckets = 0;
+int shards_count = 0; //tracked blocks
+int shards_root = -1; //treap over the tracked blocks, by last reference
+int* shards_heap = NULL; //max-heap of tracked blocks by hash (fixed-size)
+long shards_clock = 0; //sampled references so far
+long shards_refs = 0; //all references
+double mrc_hist[MRC_BUCKETS]; //weighted references per distance bucket
+double mrc_cold = 0.0; //weighted first references
+
+/* 
+ * shards_hash:
+ * The spatial hash of a block (splitmix64 finalizer).
+ */                    
+unsigned long long shards_hash(mem_addr_t block) {
+    block += 0x9E3779B97F4A7C15ULL;
+    block = (block ^ (block >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    block = (block ^ (block >> 27)) * 0x94D049BB133111EBULL;
+    return block ^ (block >> 31);
+}
+
+/* 
+ * shards_current_rate:
+ * Returns the sampling rate that belongs to the current threshold.
+ */                    
+double shards_current_rate() {
+    return ((double) shards_threshold + 1.0) / 18446744073709551616.0;
+}
+
+/* 
+ * mrc_bucket:
+ * Returns the histogram bucket of a scaled reuse distance.
+ */                    
+int mrc_bucket(double d) {
+    if (d < MRC_SUB) {
+        return (int) d;
+    }
+    int e = 63 - __builtin_clzll((unsigned long long) d);
+    int sub = (int) (d / ldexp(1.0, e - 3)) - MRC_SUB;
+    int b = MRC_SUB + (e - 3) * MRC_SUB + (sub < MRC_SUB ? sub : MRC_SUB - 1);
+    return b < MRC_BUCKETS ? b : MRC_BUCKETS - 1;
+}
+
+/* 
+ * mrc_bucket_start:
+ * Returns the smallest distance of a histogram bucket.
+ */                    
+double mrc_bucket_start(int b) {
+    if (b < MRC_SUB) {
+        return b;
+    }
+    int e = (b - MRC_SUB) / MRC_SUB + 3;
+    return ldexp(1.0, e) + ((b - MRC_SUB) % MRC_SUB) * ldexp(1.0, e - 3);
+}
+
+/* 
+ * treap_size:
+ * Returns the size of the treap rooted at t.
+ */                    
+int treap_size(int t) {
+    return t >= 0 ? shards_pool[t].size : 0;
+}
+
+/* 
+ * treap_split:
+ * Splits the treap t into the nodes with last < key (*l) and the rest (*r).
+ */                    
+void treap_split(int t, long key, int* l, int* r) {
+    if (t < 0) {
+        *l = *r = -1;
+        return;
+    }
+    shards_block_t* n = &shards_pool[t];
+    if (n->last < key) {
+        treap_split(n->right, key, &n->right, r);
+        *l = t;
+    } else {
+        treap_split(n->left, key, l, &n->left);
+        *r = t;
+    }
+    n->size = 1 + treap_size(n->left) + treap_size(n->right);
+}
+
+/* 
+ * treap_merge:
+ * Joins two treaps where every key of l is below every key of r.
+ */                    
+int treap_merge(int l, int r) {
+    if (l < 0 || r < 0) {
+        return l >= 0 ? l : r;
+    }
+    if (shards_pool[l].pri > shards_pool[r].pri) {
+        shards_pool[l].right = treap_merge(shards_pool[l].right, r);
+        shards_pool[l].size = 1 + treap_size(shards_pool[l].left) + treap_size(shards_pool[l].right);
+        return l;
+    }
+    shards_pool[r].left = treap_merge(l, shards_pool[r].left);
+    shards_pool[r].size = 1 + treap_size(shards_pool[r].left) + treap_size(shards_pool[r].right);
+    return r;
+}
+
+/* 
+ * treap_remove:
+ * Takes node i out of the treap and returns the number of nodes that were
+ * referenced after it, i.e. its reuse distance.
+ */                    
+int treap_remove(int i) {
+    int l, mid, r;
+
+    treap_split(shards_root, shards_pool[i].last, &l, &mid);
+    treap_split(mid, shards_pool[i].last + 1, &mid, &r);
+    int newer = treap_size(r);
+    shards_root = treap_merge(l, r);
+    return newer;
+}
+
+/* 
+ * treap_insert:
+ * Adds node i, the most recent reference, to the treap.
+ */                    
+void treap_insert(int i) {
+    shards_pool[i].left = shards_pool[i].right = -1;
+    shards_pool[i].size = 1;
+    shards_root = treap_merge(shards_root, i);
+}
+
+/* 
+ * shards_bucket_of:
+ * Returns the hash table bucket of a block hash.
+ */                    
+int shards_bucket_of(unsigned long long hash) {
+    return (int) (hash >> 20) & (shards_nbuckets - 1);
+}
+
+/* 
+ * shards_grow:
+ * Doubles the hash table of tracked blocks.
+ */                    
+void shards_grow() {
+    free(shards_buckets);
+    shards_nbuckets = shards_nbuckets ? shards_nbuckets * 2 : 4096;
+    shards_buckets = malloc(sizeof(int) * shards_nbuckets);
+    if (shards_buckets == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    memset(shards_buckets, 0xff, sizeof(int) * shards_nbuckets);
+
+    //Rebuild the chains from the treap, which holds every tracked block.
+    int* stack = malloc(sizeof(int) * (shards_count + 1));
+    int depth = 0;
+    if (stack == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    if (shards_root >= 0) {
+        stack[depth++] = shards_root;
+    }
+    while (depth > 0) {
+        int i = stack[--depth];
+        int b = shards_bucket_of(shards_pool[i].hash);
+        shards_pool[i].hnext = shards_buckets[b];
+        shards_buckets[b] = i;
+        if (shards_pool[i].left >= 0) {
+            stack[depth++] = shards_pool[i].left;
+        }
+        if (shards_pool[i].right >= 0) {
+            stack[depth++] = shards_pool[i].right;
+        }
+    }
+    free(stack);
+}
+
+/* 
+ * heap_push:
+ * Adds tracked block i to the max-heap by hash.
+ */                    
+void heap_push(int i) {
+    int pos = shards_count - 1;
+
+    while (pos > 0 && shards_pool[shards_heap[(pos - 1) / 2]].hash < shards_pool[i].hash) {
+        shards_heap[pos] = shards_heap[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    shards_heap[pos] = i;
+}
+
+/* 
+ * heap_pop:
+ * Removes and returns the tracked block with the largest hash.
+ */                    
+int heap_pop() {
+    int top = shards_heap[0];
+    int last = shards_heap[shards_count - 1];
+    int n = shards_count - 1;
+    int pos = 0;
+
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && shards_pool[shards_heap[child + 1]].hash > shards_pool[shards_heap[child]].hash) {
+            child++;
+        }
+        if (shards_pool[shards_heap[child]].hash <= shards_pool[last].hash) {
+            break;
+        }
+        shards_heap[pos] = shards_heap[child];
+        pos = child;
+    }
+    shards_heap[pos] = last;
+    return top;
+}
+
+/* 
+ * shards_forget:
+ * Stops tracking block i.
+ */                    
+void shards_forget(int i) {
+    int* link = &shards_buckets[shards_bucket_of(shards_pool[i].hash)];
+
+    while (*link != i) {
+        link = &shards_pool[*link].hnext;
+    }
+    *link = shards_pool[i].hnext;
+    treap_remove(i);
+    shards_pool[i].hnext = shards_free;
+    shards_free = i;
+}
+
+/* 
+ * shards_lower_rate:
+ * Fixed-size SHARDS: drops the blocks with the largest hash until the
+ * budget holds, lowers the threshold below them, and rescales the
+ * histogram to the new rate.
+ */                    
+void shards_lower_rate() {
+    double old_rate = shards_current_rate();
+    unsigned long long top = shards_pool[shards_heap[0]].hash;
+
+    while (shards_count > 0 && shards_pool[shards_heap[0]].hash >= top) {
+        int i = heap_pop();
+        shards_count--;
+        shards_forget(i);
+    }
+    shards_threshold = top - 1;
+
+    double scale = shards_current_rate() / old_rate;
+    for (int b = 0; b < MRC_BUCKETS; b++) {
+        mrc_hist[b] *= scale;
+    }
+    mrc_cold *= scale;
+}
+
+/* 
+ * init_shards:
+ * Sets up an empty SHARDS pass.
+ */                    
+void init_shards() {
+    shards_threshold = shards_rate >= 1.0 ? ~0ULL :
+        (unsigned long long) (shards_rate * 18446744073709551616.0);
+    shards_grow();
+    if (shards_max > 0) {
+        shards_heap = malloc(sizeof(int) * (shards_max + 1));
+        if (shards_heap == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+}
+
+/* 
+ * shards_access:
+ * Feeds one reference to the SHARDS pass.
+ */                    
+void shards_access(mem_addr_t addr) {
+    mem_addr_t block = addr >> b;
+    unsigned long long hash = shards_hash(block);
+    int i;
+
+    shards_refs++;
+    if (hash > shards_threshold) {
+        return;
+    }
+    shards_clock++;
+
+    for (i = shards_buckets[shards_bucket_of(hash)]; i >= 0; i = shards_pool[i].hnext) {
+        if (shards_pool[i].block == block) {
+            break;
+        }
+    }
+    if (i >= 0) {
+        int d = treap_remove(i);
+        mrc_hist[mrc_bucket(d / shards_current_rate())] += 1.0;
+        shards_pool[i].last = shards_clock;
+        treap_insert(i);
+        return;
+    }
+
+    //A block seen for the first time (at this rate).
+    mrc_cold += 1.0;
+    if (shards_free >= 0) {
+        i = shards_free;
+        shards_free = shards_pool[i].hnext;
+    } else {
+        if (shards_pool_used == shards_pool_cap) {
+            shards_pool_cap = shards_pool_cap ? shards_pool_cap * 2 : 4096;
+            shards_pool = realloc(shards_pool, sizeof(shards_block_t) * shards_pool_cap);
+            if (shards_pool == NULL) {
+                printf("Error allocating memory");
+                exit(1);
+            }
+        }
+        i = shards_pool_used++;
+    }
+    shards_pool[i].block = block;
+    shards_pool[i].hash = hash;
+    shards_pool[i].last = shards_clock;
+    shards_pool[i].pri = (unsigned int) (hash >> 32) ^ (unsigned int) shards_clock * 2654435761U;
+    treap_insert(i);
+    shards_count++;
+    if (shards_count > shards_nbuckets) {
+        shards_grow();
+    } else {
+        int bk = shards_bucket_of(hash);
+        shards_pool[i].hnext = shards_buckets[bk];
+        shards_buckets[bk] = i;
+    }
+    if (shards_max > 0) {
+        heap_push(i);
+        if (shards_count > shards_max) {
+            shards_lower_rate();
+        }
+    }
+}
+
+/* 
+ * mrc_miss_ratio:
+ * Returns the estimated miss ratio of a fully-associative LRU cache of
+ * "blocks" blocks (a power of two, or below 8): the share of references
+ * that are first references or have a reuse distance of at least
+ * "blocks". The sample size is corrected to its expected value
+ * (SHARDS-adj), crediting the difference to the smallest distance: a few
+ * hot blocks that happen to be (un)sampled would skew it otherwise. Since
+ * counts are rescaled whenever the rate drops, the expected value is
+ * all references times the final rate in both modes.
+ */                    
+double mrc_miss_ratio(double blocks) {
+    double total = shards_refs * shards_current_rate();
+    double misses = mrc_cold;
+
+    for (int bk = mrc_bucket(blocks); bk < MRC_BUCKETS; bk++) {
+        misses += mrc_hist[bk];
+    }
+    if (total <= 0.0) {
+        return 0.0;
+    }
+    return misses / total < 1.0 ? misses / total : 1.0;
+}
+
+/* 
+ * mrc_max_blocks:
+ * Returns the first power of two beyond every measured distance, the
+ * largest cache size worth reporting.
+ */                    
+double mrc_max_blocks() {
+    int last = 0;
+
+    for (int bk = 0; bk < MRC_BUCKETS; bk++) {
+        if (mrc_hist[bk] > 0.0) {
+            last = bk;
+        }
+    }
+    double blocks = 1.0;
+    while (blocks <= mrc_bucket_start(last)) {
+        blocks *= 2.0;
+    }
+    return blocks;
+}
+
+/* 
+ * free_shards:
+ * Frees the SHARDS state.
+ */                    
+void free_shards() {
+    free(shards_pool);
+    free(shards_buckets);
+    free(shards_heap);
+    shards_pool = NULL;
+    shards_buckets = NULL;
+    shards_heap = NULL;
+}
+
+
+/* 
+ * record_access:
+ * Credits the outcome of one access of the current record to its region
+ * and to the timing model.
+ */                    
+void record_access(int region, mem_addr_t addr, int result) {
+    if (region >= 0) {
+        region_count(region, result);
+    }
+    if (timing) {
+        timing_access(addr, result);
+    }
+}
+
+
+/* 
+ * replay_record:
+ * Simulates one decoded trace record against the cache.
+ * "L" and "S" are one access, "M" is a load followed by a store, "I" is
+ * an instruction fetch in split I/D mode, and everything else is ignored.
+ * With a region map, the L1 outcomes are credited to the region of the
+ * (virtual) address, and with --timing they are timed. A --shards pass
+ * only samples the addresses.
+ */                    
+void replay_record(char op, mem_addr_t addr, unsigned int len) {
+    int region = -1;
+
+    if (op != 'S' && op != 'L' && op != 'M' && (op != 'I' || !split_i)) {
+        return;
+    }
+    if (num_regions > 0) {
+        region = region_find(addr);
+        if (region_filter && region == num_region_names) {
+            return;
+        }
+    }
+    if (shards_rate > 0.0) {
+        shards_access(addr);
+        if (op == 'M') {
+            shards_access(addr);
+        }
+        return;
+    }
+
+    if (verbosity)
+        printf("%c %llx,%u ", op, addr, len);
+
+    if (page_map != MAP_IDENTITY) {
+        addr = translate_addr(addr);
+    }
+
+    if (timing) {
+        timing_issue();
+    }
+    if (op == 'I') {
+        record_access(region, addr, access_inst(addr));
+    } else {
+        record_access(region, addr, access_data(addr));
+        if (op == 'M') {
+            record_access(region, addr, access_data(addr));
+        }
+    }
+
+    if (verbosity)
+        printf("\n");
+}
+
+/* 
+ * free_trace:
+ * Frees the records of an in-memory trace.
+ */                    
+void free_trace(trace_buf_t* tb) {
+    free(tb->recs);
+    tb->recs = NULL;
+    tb->n = 0;
+    tb->cap = 0;
+}
+
+
+/* 
+ * push_rec:
+ * Appends one record to an in-memory trace, growing it as needed.
+ */                    
+void push_rec(trace_buf_t* tb, char op, mem_addr_t addr, unsigned int len) {
+    if (tb->n == tb->cap) {
+        tb->cap = tb->cap ? tb->cap * 2 : 4096;
+        tb->recs = realloc(tb->recs, sizeof(trace_rec_t) * tb->cap);
+        if (tb->recs == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+    tb->recs[tb->n].addr = addr;
+    tb->recs[tb->n].len = len;
+    tb->recs[tb->n].op = op;
+    tb->n++;
+}
+
+
+/* 
+ * replay_loop:
+ * Replays a loop record: the n body records, "reps" times.
+ *
+ * An iteration in which every access hits cannot change which lines are
+ * resident, and it leaves the recency order of the set the same as the
+ * previous iteration did, so every later iteration would hit as well.
+ * Once such a steady state is seen, the remaining iterations are credited
+ * as hits without simulating them (not in verbose mode, not with
+ * --reuse, whose per-line hit counts would be skewed, and not with a
+ * region map, --timing or --shards, which need every access).
+ */                    
+void replay_loop(trace_rec_t* body, size_t n, long reps) {
+    long data_per_iter = 0;
+    long inst_per_iter = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (body[i].op == 'L' || body[i].op == 'S') {
+            data_per_iter++;
+        } else if (body[i].op == 'M') {
+            data_per_iter += 2;
+        } else if (body[i].op == 'I' && split_i) {
+            inst_per_iter++;
+        }
+    }
+
+    for (long it = 0; it < reps; it++) {
+        long misses = cache.miss_cnt + icache.miss_cnt;
+
+        for (size_t i = 0; i < n; i++) {
+            replay_record(body[i].op, body[i].addr, body[i].len);
+        }
+
+        if (!verbosity && cache.reuse == NULL && num_regions == 0 && !timing &&
+                shards_rate == 0.0 && cache.miss_cnt + icache.miss_cnt == misses) {
+            long skipped = reps - it - 1;
+            skip_hits(&cache, skipped * data_per_iter);
+            skip_hits(&icache, skipped * inst_per_iter);
+            loop_iters_skipped += skipped;
+            return;
+        }
+    }
+}
+
+
+//Hex digit values for the scalar decoder, -1 for everything else.
+signed char hex_value[256];
+
+/* 
+ * init_hex_value:
+ * Fills the hex_value table.
+ */                    
+void init_hex_value() {
+    memset(hex_value, -1, sizeof(hex_value));
+    for (int i = 0; i < 10; i++) {
+        hex_value['0' + i] = i;
+    }
+    for (int i = 0; i < 6; i++) {
+        hex_value['a' + i] = 10 + i;
+        hex_value['A' + i] = 10 + i;
+    }
+}
+
+/* 
+ * hex_scalar:
+ * Decodes up to 16 leading hex digits of p into *out, one at a time.
+ * Returns the number of digits, or 0 if there are none or more than 15
+ * (those cases are left to sscanf(), like in hex_simd()).
+ */                    
+int hex_scalar(const char* p, mem_addr_t* out) {
+    mem_addr_t val = 0;
+    int n = 0;
+
+    while (n < 16 && hex_value[(unsigned char) p[n]] >= 0) {
+        val = (val << 4) | hex_value[(unsigned char) p[n]];
+        n++;
+    }
+    if (n == 16) {
+        return 0;
+    }
+    *out = val;
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//pshufb controls that right-align n digits: a window starting at offset n.
+const signed char hex_align[32] = {
+    -128, -128, -128, -128, -128, -128, -128, -128,
+    -128, -128, -128, -128, -128, -128, -128, -128,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/* 
+ * hex_simd:
+ * SSSE3 version of hex_scalar(). Classifies 16 characters at once, finds
+ * the first non-hex one with a movemask, turns the digits into nibbles,
+ * right-aligns them with one shuffle and merges them pairwise with two
+ * multiply-adds (nibbles -> bytes -> 16-bit words). Reads 16 bytes from p,
+ * so p must have that much readable buffer behind it.
+ */                    
+__attribute__((target("ssse3")))
+int hex_simd(const char* p, mem_addr_t* out) {
+    __m128i v = _mm_loadu_si128((const __m128i*) p);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    unsigned int mask = _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+    int n = __builtin_ctz(~mask);
+
+    if (n == 0 || n == 16) {
+        return 0;
+    }
+
+    __m128i nib = _mm_or_si128(
+            _mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+            _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    nib = _mm_shuffle_epi8(nib, _mm_loadu_si128((const __m128i*) (hex_align + n)));
+    __m128i bytes = _mm_maddubs_epi16(nib, _mm_set1_epi16(0x0110));
+    __m128i words = _mm_madd_epi16(bytes, _mm_set1_epi32(0x00010100));
+
+    unsigned int w[4];
+    _mm_storeu_si128((__m128i*) w, words);
+    *out = ((mem_addr_t) w[0] << 48) | ((mem_addr_t) w[1] << 32) |
+        ((mem_addr_t) w[2] << 16) | w[3];
+    return n;
+}
+#endif
+
+//The hex kernel in use, chosen by init_decoder().
+int (*decode_hex)(const char*, mem_addr_t*) = hex_scalar;
+
+/* 
+ * init_decoder:
+ * Picks the SIMD hex kernel if the host supports it.
+ */                    
+void init_decoder() {
+    init_hex_value();
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3")) {
+        decode_hex = hex_simd;
+    }
+#endif
+}
+
+/* 
+ * decode_fields:
+ * Fast replacement for sscanf(p, "%llx,%u", addr, len) on the common
+ * shape "<1-15 hex digits>,<1-9 decimal digits>". Anything else (leading
+ * blanks, a 0x prefix, overlong numbers, a missing comma) falls back to
+ * sscanf() so the results are always the same.
+ */                    
+void decode_fields(const char* p, mem_addr_t* addr, unsigned int* len) {
+    mem_addr_t a;
+    unsigned int l = 0;
+    int n = decode_hex(p, &a);
+    int d = 0;
+
+    if (n > 0 && p[n] == ',') {
+        p += n + 1;
+        while (d < 10 && p[d] >= '0' && p[d] <= '9') {
+            l = l * 10 + (p[d] - '0');
+            d++;
+        }
+        if (d > 0 && d < 10) {
+            *addr = a;
+            *len = l;
+            return;
+        }
+        p -= n + 1;
+    }
+    sscanf(p, "%llx,%u", addr, len);
+}
+
+/* 
+ * parse_line:
+ * Decodes the address and size of a Valgrind " L addr,len" line, or of an
+ * "I  addr,len" line in split I/D mode. A loop record "R reps,n" (see
+ * compact_trace()) is returned as op 'R' with addr = reps and len = n.
+ * buf must be at least 19 bytes long, see hex_simd().
+ * Returns the record's op, or 0 for lines that are not simulated.
+ */                    
+char parse_line(char* buf, mem_addr_t* addr, unsigned int* len) {
+    char op = buf[1];
+
+    if (buf[0] == 'R') {
+        sscanf(buf+2, "%llu,%u", addr, len);
+        return 'R';
+    }
+    if (op != 'S' && op != 'L' && op != 'M') {
+        if (buf[0] != 'I' || !split_i) {
+            return 0;
+        }
+        op = 'I';
+    }
+    decode_fields(buf+3, addr, len);
+    return op;
+}
+
+/* 
+ * now_sec:
+ * Returns a monotonic timestamp in seconds.
+ */                    
+double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+//Globals for the progress reporter (--progress). replay_trace() publishes
+//its position every PROGRESS_BATCH lines, and within loop records about
+//every PROGRESS_BATCH records, with relaxed atomic stores, and
+//a sampling thread reads them, so the hot loop never synchronizes.
+#define PROGRESS_BATCH 65536
+double progress_interval = 0.0; //seconds between reports, 0 when off
+long long progress_total = 0; //size of the trace in bytes
+long long progress_bytes = 0; //published: trace bytes consumed
+long progress_accesses = 0; //published: accesses simulated
+long progress_misses = 0; //published: misses among them
+int progress_done = 0; //set under progress_lock to stop the reporter
+pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+pthread_t progress_thread;
+
+/* 
+ * progress_publish:
+ * Publishes the replay position and the L1 counters for the reporter.
+ */                    
+void progress_publish(FILE* trace_fp) {
+    __atomic_store_n(&progress_bytes, (long long) ftello(trace_fp), __ATOMIC_RELAXED);
+    __atomic_store_n(&progress_accesses, cache.hit_cnt + cache.miss_cnt +
+            icache.hit_cnt + icache.miss_cnt, __ATOMIC_RELAXED);
+    __atomic_store_n(&progress_misses, cache.miss_cnt + icache.miss_cnt, __ATOMIC_RELAXED);
+}
+
+/* 
+ * progress_worker:
+ * Thread body of the reporter: every progress_interval seconds prints
+ * the bytes consumed, the access rate since the last report, the running
+ * miss ratio and an ETA extrapolated from the bytes left, to stderr.
+ */                    
+void* progress_worker(void* arg) {
+    double start = now_sec();
+    double last = start;
+    long last_accesses = 0;
+
+    (void) arg;
+    pthread_mutex_lock(&progress_lock);
+    while (!progress_done) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        long long ns = ts.tv_nsec + (long long) (progress_interval * 1e9);
+        ts.tv_sec += ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        pthread_cond_timedwait(&progress_cond, &progress_lock, &ts);
+        if (progress_done) {
+            break;
+        }
+
+        long long bytes = __atomic_load_n(&progress_bytes, __ATOMIC_RELAXED);
+        long accesses = __atomic_load_n(&progress_accesses, __ATOMIC_RELAXED);
+        long misses = __atomic_load_n(&progress_misses, __ATOMIC_RELAXED);
+        double now = now_sec();
+        double frac = progress_total > 0 ? (double) bytes / progress_total : 0.0;
+        long eta = frac > 0.0 ? (long) ((now - start) * (1.0 - frac) / frac) : 0;
+
+        fprintf(stderr, "progress: %.1f/%.1f MB (%.1f%%), %.2fM accesses/s, "
+                "miss ratio %.4f, ETA %ld:%02ld:%02ld\n",
+                bytes / 1048576.0, progress_total / 1048576.0, 100.0 * frac,
+                (accesses - last_accesses) / (now - last) / 1e6,
+                accesses > 0 ? (double) misses / accesses : 0.0,
+                eta / 3600, eta / 60 % 60, eta % 60);
+        last = now;
+        last_accesses = accesses;
+    }
+    pthread_mutex_unlock(&progress_lock);
+    return NULL;
+}
+
+/* 
+ * start_progress:
+ * Starts the reporter for a replay of trace_fn.
+ */                    
+void start_progress(char* trace_fn) {
+    struct stat st;
+
+    progress_total = stat(trace_fn, &st) == 0 ? st.st_size : 0;
+    progress_done = 0;
+    pthread_create(&progress_thread, NULL, progress_worker, NULL);
+}
+
+/* 
+ * stop_progress:
+ * Wakes the reporter up and waits for it to exit.
+ */                    
+void stop_progress() {
+    pthread_mutex_lock(&progress_lock);
+    progress_done = 1;
+    pthread_cond_signal(&progress_cond);
+    pthread_mutex_unlock(&progress_lock);
+    pthread_join(progress_thread, NULL);
+}
+
+/* 
+ * replay_trace:
+ * Replays the given trace file against the cache.
+ *
+ * Reads the input trace file line by line.
+ * Extracts the type of each memory access : L/S/M
+ * TRANSLATE each "L" as a load i.e. 1 memory access
+ * TRANSLATE each "S" as a store i.e. 1 memory access
+ * TRANSLATE each "M" as a load followed by a store i.e. 2 memory accesses 
+ * With --progress, publishes its position every PROGRESS_BATCH lines.
+ */                    
+void replay_trace(char* trace_fn) {           
+	char buf[1000];  
+	mem_addr_t addr = 0;
+	unsigned int len = 0;
+	unsigned long lines = 0;
+	char op;
+	FILE* trace_fp = fopen(trace_fn, "r"); 
+
+	if (!trace_fp) { 
+		fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+		exit(1);   
+	}
+
+	while (fgets(buf, 1000, trace_fp) != NULL) {
+		if ((++lines & (PROGRESS_BATCH - 1)) == 0 && progress_interval > 0.0) {
+			progress_publish(trace_fp);
+		}
+		if ((op = parse_line(buf, &addr, &len)) == 'R') {
+            //Read the loop body, then replay it as a whole.
+            trace_buf_t body = {0};
+            long reps = addr;
+            unsigned int body_len = len;
+            for (unsigned int i = 0; i < body_len && fgets(buf, 1000, trace_fp) != NULL; i++) {
+                if ((op = parse_line(buf, &addr, &len)) && op != 'R') {
+                    push_rec(&body, op, addr, len);
+                }
+            }
+            if (progress_interval > 0.0) {
+                //One line can stand for any number of accesses: replay it
+                //in slices of about PROGRESS_BATCH records and publish
+                //after each. A slice that starts in the steady state hits
+                //throughout, so the counts are the same as in one call.
+                long slice = body.n ? PROGRESS_BATCH / (long) body.n + 1 : reps;
+                for (long done = 0; done < reps; done += slice) {
+                    replay_loop(body.recs, body.n, reps - done < slice ? reps - done : slice);
+                    progress_publish(trace_fp);
+                }
+            } else {
+                replay_loop(body.recs, body.n, reps);
+            }
+            free_trace(&body);
+		} else if (op) {
+            replay_record(op, addr, len);
+		}
+	}
+
+	fclose(trace_fp);
+}  
+
+
+/* 
+ * replay_buffer:
+ * Replays an in-memory trace against the cache. Same semantics as
+ * replay_trace() but without any parsing or I/O.
+ */                    
+void replay_buffer(trace_buf_t* tb) {
+    for (size_t i = 0; i < tb->n; i++) {
+        if (tb->recs[i].op == 'R') {
+            size_t n = tb->recs[i].len;
+            if (n > tb->n - i - 1) {
+                n = tb->n - i - 1;
+            }
+            replay_loop(&tb->recs[i + 1], n, tb->recs[i].addr);
+            i += n;
+        } else {
+            replay_record(tb->recs[i].op, tb->recs[i].addr, tb->recs[i].len);
+        }
+    }
+}
+
+
+//Type loader_t: Loop bookkeeping while decoding a trace into memory.
+typedef struct loader {
+    size_t loop_at; //index of the open "R" record
+    unsigned int loop_left; //body lines of it still to read
+} loader_t;
+
+/* 
+ * add_line:
+ * Decodes one trace line into tb. A loop record's body length is
+ * rewritten to the number of body records actually kept, since lines that
+ * parse_line() skips (e.g. "I" without --icache) still count in its
+ * "R reps,n" header.
+ */                    
+void add_line(trace_buf_t* tb, char* buf, loader_t* ld) {
+    mem_addr_t addr = 0;
+    unsigned int len = 0;
+    char op = parse_line(buf, &addr, &len);
+
+    if (ld->loop_left > 0) {
+        ld->loop_left--;
+        if (op && op != 'R') {
+            push_rec(tb, op, addr, len);
+            tb->recs[ld->loop_at].len++;
+        }
+    } else if (op == 'R') {
+        ld->loop_at = tb->n;
+        ld->loop_left = len;
+        push_rec(tb, op, addr, 0);
+    } else if (op) {
+        push_rec(tb, op, addr, len);
+    }
+}
+
+/* 
+ * load_trace:
+ * Decodes a whole trace file into memory without simulating it, so the
+ * parse cost can be separated from the cost of access_data().
+ */                    
+void load_trace(char* trace_fn, trace_buf_t* tb) {
+    char buf[1000];
+    loader_t ld = {0};
+    FILE* trace_fp = fopen(trace_fn, "r");
+
+    if (!trace_fp) {
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        exit(1);
+    }
+
+    while (fgets(buf, 1000, trace_fp) != NULL) {
+        add_line(tb, buf, &ld);
+    }
+
+    fclose(trace_fp);
+}
+
+
+//State of the generator's xorshift64* PRNG.
+unsigned long long rng_state = 1;
+
+/* 
+ * rand64:
+ * Returns the next 64-bit value of the xorshift64* generator.
+ */                    
+unsigned long long rand64() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* 
+ * rand_double:
+ * Returns a uniformly distributed double in [0, 1).
+ */                    
+double rand_double() {
+    return (rand64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/* 
+ * check_decoder:
+ * Fuzzes decode_fields() (with both the SIMD and the scalar kernel)
+ * against sscanf() on random well-formed and malformed address fields.
+ * Prints the first mismatch. Returns the process exit status.
+ */                    
+int check_decoder(long iterations) {
+    const char* chars = "0123456789abcdefABCDEFxX, \t+-g\n";
+    int (*kernels[2])(const char*, mem_addr_t*) = {decode_hex, hex_scalar};
+
+    rng_state = gen_seed ? gen_seed : 1;
+    for (long it = 0; it < iterations; it++) {
+        char buf[64];
+        int pos = 0;
+
+        memset(buf, 0, sizeof(buf));
+        if (rand64() % 4 == 0) {
+            //Arbitrary noise from the interesting character set.
+            int n = rand64() % 30;
+            while (pos < n) {
+                buf[pos++] = chars[rand64() % strlen(chars)];
+            }
+        } else {
+            int digits = 1 + rand64() % 18;
+            if (rand64() % 16 == 0) {
+                buf[pos++] = rand64() % 2 ? ' ' : '0';
+                buf[pos++] = rand64() % 2 ? 'x' : ' ';
+            }
+            for (int i = 0; i < digits; i++) {
+                buf[pos++] = "0123456789abcdefABCDEF"[rand64() % 22];
+            }
+            if (rand64() % 16) {
+                buf[pos++] = ',';
+            }
+            int ldigits = rand64() % 12;
+            for (int i = 0; i < ldigits; i++) {
+                buf[pos++] = '0' + rand64() % 10;
+            }
+            buf[pos++] = '\n';
+        }
+
+        mem_addr_t want_addr = 0x5a5a, got_addr;
+        unsigned int want_len = 77, got_len;
+        sscanf(buf, "%llx,%u", &want_addr, &want_len);
+
+        for (int k = 0; k < 2; k++) {
+            decode_hex = kernels[k];
+            got_addr = 0x5a5a;
+            got_len = 77;
+            decode_fields(buf, &got_addr, &got_len);
+            if (got_addr != want_addr || got_len != want_len) {
+                buf[strcspn(buf, "\n")] = '\0';
+                printf("decoder mismatch (%s kernel) on \"%s\": got %llx,%u want %llx,%u\n",
+                        k ? "scalar" : "default", buf, got_addr, got_len, want_addr, want_len);
+                return 1;
+            }
+        }
+        decode_hex = kernels[0];
+    }
+    printf("decoder: %ld cases match sscanf\n", iterations);
+    return 0;
+}
+
+
+/* 
+ * parse_size:
+ * Parses a byte count with an optional K, M or G suffix (powers of 1024).
+ */                    
+unsigned long long parse_size(const char* str) {
+    char* end;
+    unsigned long long val = strtoull(str, &end, 0);
+
+    if (*end == 'K' || *end == 'k') {
+        val <<= 10;
+    } else if (*end == 'M' || *end == 'm') {
+        val <<= 20;
+    } else if (*end == 'G' || *end == 'g') {
+        val <<= 30;
+    }
+    return val;
+}
+
+
+//Base address of the synthetic data region, so streams look like heap data.
+#define GEN_BASE 0x10000000ULL
+
+/* 
+ * gen_zipf:
+ * Appends n Zipf(theta) distributed loads over "items" blocks, using the
+ * constant-time sampler of Gray et al. ("Quickly generating billion-record
+ * synthetic databases"), which only holds for 0 < theta < 1. Ranks are
+ * scattered with a multiplicative hash so that the hot blocks are not all
+ * adjacent in memory.
+ */                    
+void gen_zipf(trace_buf_t* tb, long n, unsigned long long items, double theta) {
+    double zetan = 0.0;
+    for (unsigned long long i = 1; i <= items; i++) {
+        zetan += 1.0 / pow((double) i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    double alpha = 1.0 / (1.0 - theta);
+    double eta = (1.0 - pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+
+    for (long i = 0; i < n; i++) {
+        double u = rand_double();
+        double uz = u * zetan;
+        unsigned long long rank;
+
+        if (uz < 1.0) {
+            rank = 0;
+        } else if (uz < zeta2) {
+            rank = 1;
+        } else {
+            rank = (unsigned long long) (items * pow(eta * u - eta + 1.0, alpha));
+            if (rank >= items) {
+                rank = items - 1;
+            }
+        }
+        rank = (rank * 2654435761ULL) % items;
+        push_rec(tb, 'L', GEN_BASE + rank * 64, 8);
+    }
+}
+
+/* 
+ * gen_pointer_chase:
+ * Appends n loads that follow a single random cycle through all nodes
+ * (Sattolo's algorithm), so every load depends on the previous one and
+ * there is no spatial locality between consecutive accesses.
+ */                    
+void gen_pointer_chase(trace_buf_t* tb, long n, unsigned long long nodes,
+        unsigned long long node_size) {
+    unsigned int* next = malloc(sizeof(unsigned int) * nodes);
+    if (next == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+
+    for (unsigned long long i = 0; i < nodes; i++) {
+        next[i] = i;
+    }
+    for (unsigned long long i = nodes - 1; i > 0; i--) {
+        unsigned long long j = rand64() % i;
+        unsigned int tmp = next[i];
+        next[i] = next[j];
+        next[j] = tmp;
+    }
+
+    unsigned long long cur = 0;
+    for (long i = 0; i < n; i++) {
+        push_rec(tb, 'L', GEN_BASE + cur * node_size, 8);
+        cur = next[cur];
+    }
+    free(next);
+}
+
+/* 
+ * gen_matmul:
+ * Appends the accesses of a tiled C += A * B on N x N doubles, with N chosen
+ * so that the three matrices fill the footprint. The loop nest restarts
+ * until n accesses have been produced.
+ */                    
+void gen_matmul(trace_buf_t* tb, long n, unsigned long long footprint,
+        unsigned long long tile) {
+    unsigned long long dim = (unsigned long long) sqrt(footprint / 24.0);
+    if (dim < 1) {
+        dim = 1;
+    }
+    if (tile < 1 || tile > dim) {
+        tile = dim;
+    }
+
+    mem_addr_t a = GEN_BASE;
+    mem_addr_t bm = a + dim * dim * 8;
+    mem_addr_t c = bm + dim * dim * 8;
+
+    while ((long) tb->n < n) {
+        for (unsigned long long ii = 0; ii < dim; ii += tile)
+        for (unsigned long long jj = 0; jj < dim; jj += tile)
+        for (unsigned long long kk = 0; kk < dim; kk += tile)
+        for (unsigned long long i = ii; i < ii + tile && i < dim; i++)
+        for (unsigned long long j = jj; j < jj + tile && j < dim; j++) {
+            push_rec(tb, 'L', c + (i * dim + j) * 8, 8);
+            for (unsigned long long k = kk; k < kk + tile && k < dim; k++) {
+                push_rec(tb, 'L', a + (i * dim + k) * 8, 8);
+                push_rec(tb, 'L', bm + (k * dim + j) * 8, 8);
+            }
+            push_rec(tb, 'S', c + (i * dim + j) * 8, 8);
+            if ((long) tb->n >= n) {
+                return;
+            }
+        }
+    }
+}
+
+/* 
+ * generate_trace:
+ * Fills tb with gen_count accesses of the pattern named by gen_spec:
+ *   seq              sequential 8-byte loads over the footprint
+ *   strided[:bytes]  loads with the given stride (default 64)
+ *   random           uniformly random 8-byte aligned loads
+ *   zipf[:theta]     Zipf distributed block loads, 0 < theta < 1 (default 0.99)
+ *   chase[:bytes]    pointer chase over nodes of the given size (default 64)
+ *   matmul[:tile]    tiled matrix multiply (default tile 32)
+ * All patterns wrap around within gen_footprint bytes.
+ */                    
+void generate_trace(trace_buf_t* tb) {
+    char kind[32];
+    const char* param = strchr(gen_spec, ':');
+    size_t klen = param ? (size_t) (param - gen_spec) : strlen(gen_spec);
+    unsigned long long fp = gen_footprint;
+
+    if (klen >= sizeof(kind) || fp < 64) {
+        printf("Invalid generator: %s\n", gen_spec);
+        exit(1);
+    }
+    memcpy(kind, gen_spec, klen);
+    kind[klen] = '\0';
+    if (param) {
+        param++;
+    }
+
+    rng_state = gen_seed ? gen_seed : 1;
+    tb->cap = gen_count + 1;
+    tb->recs = malloc(sizeof(trace_rec_t) * tb->cap);
+    if (tb->recs == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+
+    if (strcmp(kind, "seq") == 0) {
+        for (long i = 0; i < gen_count; i++) {
+            push_rec(tb, 'L', GEN_BASE + (i * 8ULL) % fp, 8);
+        }
+    } else if (strcmp(kind, "strided") == 0) {
+        unsigned long long stride = param ? parse_size(param) : 64;
+        for (long i = 0; i < gen_count; i++) {
+            push_rec(tb, 'L', GEN_BASE + (i * stride) % fp, 8);
+        }
+    } else if (strcmp(kind, "random") == 0) {
+        for (long i = 0; i < gen_count; i++) {
+            push_rec(tb, 'L', GEN_BASE + (rand64() % (fp / 8)) * 8, 8);
+        }
+    } else if (strcmp(kind, "zipf") == 0) {
+        double theta = param ? atof(param) : 0.99;
+        if (!(theta > 0.0 && theta < 1.0)) {
+            printf("Invalid zipf theta: %s (needs 0 < theta < 1)\n", param);
+            exit(1);
+        }
+        gen_zipf(tb, gen_count, fp / 64, theta);
+    } else if (strcmp(kind, "chase") == 0) {
+        unsigned long long node = param ? parse_size(param) : 64;
+        if (node < 8 || fp / node < 2 || fp / node > UINT_MAX) {
+            printf("Invalid chase node size: %s\n", param);
+            exit(1);
+        }
+        gen_pointer_chase(tb, gen_count, fp / node, node);
+    } else if (strcmp(kind, "matmul") == 0) {
+        gen_matmul(tb, gen_count, fp, param ? strtoull(param, NULL, 0) : 32);
+    } else {
+        printf("Unknown generator: %s\n", kind);
+        exit(1);
+    }
+}
+
+
+//Longest loop body the compactor looks for, in records.
+#define COMPACT_MAX_PERIOD 256
+
+//First line of a compacted trace, followed by the block bits it was folded
+//at. Trace readers skip it like any other line that is not a record.
+#define COMPACT_TAG "# csim compacted b="
+
+/* 
+ * compacted_bits:
+ * Returns the block bits trace_fn was compacted at, or -1 if it is not a
+ * compacted trace.
+ */                    
+int compacted_bits(const char* trace_fn) {
+    char buf[100];
+    int bits = -1;
+    FILE* fp = fopen(trace_fn, "r");
+
+    if (!fp) {
+        return -1;
+    }
+    if (fgets(buf, sizeof(buf), fp) != NULL &&
+            strncmp(buf, COMPACT_TAG, strlen(COMPACT_TAG)) == 0) {
+        bits = atoi(buf + strlen(COMPACT_TAG));
+    }
+    fclose(fp);
+    return bits;
+}
+
+/* 
+ * check_compacted:
+ * Exits if trace_fn was compacted at a coarser granularity than the run
+ * needs: a block size below 2^bits of the compactor, sectors, or region
+ * boundaries inside such a block would all see the first iteration's byte
+ * offsets instead of the real ones.
+ */                    
+void check_compacted(const char* trace_fn, int b, int sector_bits) {
+    int bits = compacted_bits(trace_fn);
+
+    if (bits < 0) {
+        return;
+    }
+    if (b - sector_bits < bits) {
+        printf("%s: compacted at block size 2^%d, needs -b %d or more and no --sectors\n",
+                trace_fn, bits, bits);
+        exit(1);
+    }
+    for (size_t i = 0; i < num_regions; i++) {
+        mem_addr_t mask = ((mem_addr_t) 1 << bits) - 1;
+        if ((regions[i].start & mask) || (regions[i].end & mask)) {
+            printf("%s: compacted at block size 2^%d, region boundaries must be aligned to it\n",
+                    trace_fn, bits);
+            exit(1);
+        }
+    }
+}
+
+/* 
+ * same_block:
+ * Returns 1 if two records are the same op on the same block.
+ */                    
+int same_block(trace_rec_t* x, trace_rec_t* y, int bits) {
+    return x->op == y->op && (x->addr >> bits) == (y->addr >> bits);
+}
+
+/* 
+ * write_rec:
+ * Writes one record in Valgrind trace format.
+ */                    
+void write_rec(FILE* fp, trace_rec_t* r) {
+    if (r->op == 'I') {
+        fprintf(fp, "I  %llx,%u\n", r->addr, r->len);
+    } else {
+        fprintf(fp, " %c %llx,%u\n", r->op, r->addr, r->len);
+    }
+}
+
+/* 
+ * compact_trace:
+ * Rewrites a trace with repeated access sequences folded into loop
+ * records. At each position the shortest period p (up to
+ * COMPACT_MAX_PERIOD) whose next p records repeat at block granularity
+ * (same op, same addr >> bits) is found, and the whole run is written as
+ *   R <reps>,<p>
+ * followed by the p records of its first iteration. A run of a single
+ * repeated record is the p = 1 (run-length) case. Byte offsets within a
+ * block are taken from the first iteration, so the output starts with a
+ * COMPACT_TAG line and check_compacted() refuses to replay it at a finer
+ * granularity than 2^bits.
+ */                    
+void compact_trace(char* trace_fn, char* out_fn, int bits) {
+    trace_buf_t tb = {0};
+    size_t i = 0;
+    long loops = 0;
+    size_t out_lines = 0;
+    FILE* out_fp;
+
+    //Keep "I" records, they are copied through like data records.
+    split_i = 1;
+    load_trace(trace_fn, &tb);
+
+    out_fp = fopen(out_fn, "w");
+    if (!out_fp) {
+        fprintf(stderr, "%s: %s\n", out_fn, strerror(errno));
+        exit(1);
+    }
+    //Loops already in the input keep the granularity they were folded at.
+    if (compacted_bits(trace_fn) > bits) {
+        bits = compacted_bits(trace_fn);
+    }
+    fprintf(out_fp, COMPACT_TAG "%d\n", bits);
+
+    while (i < tb.n) {
+        size_t best_p = 0;
+        long best_reps = 0;
+
+        for (size_t p = 1; p <= COMPACT_MAX_PERIOD && i + 2 * p <= tb.n; p++) {
+            size_t k = 0;
+
+            if (tb.recs[i + p].op == 'R' || !same_block(&tb.recs[i], &tb.recs[i + p], bits)) {
+                continue;
+            }
+            while (i + p + k < tb.n && tb.recs[i + p + k].op != 'R' &&
+                    same_block(&tb.recs[i + k], &tb.recs[i + p + k], bits)) {
+                k++;
+            }
+            //k records match one period later: the first k + p form k/p + 1
+            //iterations. Take it unless it saves no more than the header costs.
+            if (k >= p && p * (k / p) > 1) {
+                best_p = p;
+                best_reps = k / p + 1;
+                break;
+            }
+        }
+
+        if (best_reps >= 2) {
+            fprintf(out_fp, "R %ld,%zu\n", best_reps, best_p);
+            for (size_t j = 0; j < best_p; j++) {
+                write_rec(out_fp, &tb.recs[i + j]);
+            }
+            i += best_p * best_reps;
+            out_lines += best_p + 1;
+            loops++;
+        } else if (tb.recs[i].op == 'R') {
+            //Already a loop record: copy it and its body unchanged.
+            size_t body = tb.recs[i].len;
+            fprintf(out_fp, "R %llu,%zu\n", tb.recs[i].addr, body);
+            for (size_t j = 1; j <= body && i + j < tb.n; j++) {
+                write_rec(out_fp, &tb.recs[i + j]);
+            }
+            i += body + 1;
+            out_lines += body + 1;
+        } else {
+            write_rec(out_fp, &tb.recs[i]);
+            i++;
+            out_lines++;
+        }
+    }
+
+    fclose(out_fp);
+    printf("compacted %zu records into %zu lines (%ld loops)\n", tb.n, out_lines, loops);
+    free_trace(&tb);
+}
+
+
+/* 
+ * put_json_string:
+ * Writes s as a JSON string literal, escaping quotes, backslashes and
+ * control characters.
+ */                    
+void put_json_string(FILE* fp, const char* s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char ch = *s;
+        if (ch == '"' || ch == '\\') {
+            fprintf(fp, "\\%c", ch);
+        } else if (ch == '\n') {
+            fputs("\\n", fp);
+        } else if (ch == '\t') {
+            fputs("\\t", fp);
+        } else if (ch < 0x20) {
+            fprintf(fp, "\\u%04x", ch);
+        } else {
+            fputc(ch, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* 
+ * put_csv_field:
+ * Writes s as a CSV field, quoted (with doubled quotes) if it contains a
+ * comma, a quote or a line break.
+ */                    
+void put_csv_field(FILE* fp, const char* s) {
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        fputs(s, fp);
+        return;
+    }
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"') {
+            fputc('"', fp);
+        }
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+
+//Globals for the benchmark harness (--bench, --baseline, --tolerance).
+char* bench_baseline = NULL; //baseline JSON to compare against
+double bench_tolerance = 10.0; //allowed ns/access slowdown in percent
+
+//Type bench_config_t: One cache geometry of the benchmark matrix.
+typedef struct bench_config {
+    const char* name;
+    int s;
+    int E;
+} bench_config_t;
+
+//The fixed benchmark matrix (b = 6): small and large S for each associativity.
+bench_config_t bench_configs[] = {
+    {"dm-small", 4, 1},      {"dm-large", 14, 1},
+    {"4way-small", 4, 4},    {"4way-large", 12, 4},
+    {"16way-small", 2, 16},  {"16way-large", 10, 16},
+    {"fa-small", 0, 64},     {"fa-large", 0, 1024},
+};
+
+//Generated patterns replayed by the benchmark.
+const char* bench_patterns[] = {"seq", "random", "zipf", "chase", "matmul"};
+
+//Number of timed repetitions per run; the fastest one is reported.
+#define BENCH_REPS 3
+
+/* 
+ * reset_stats:
+ * Clears the hit, miss and eviction counters of the cache.
+ */                    
+void reset_stats() {
+    cache.hit_cnt = 0;
+    cache.miss_cnt = 0;
+    cache.evict_cnt = 0;
+}
+
+/* 
+ * json_field:
+ * Returns the text just past "<key>": in a line of JSON written by
+ * put_json_string() and printf(), or NULL. An escaped string value cannot
+ * contain the pattern, since its quotes are all preceded by a backslash.
+ */                    
+const char* json_field(const char* line, const char* key) {
+    char pat[64];
+    const char* p;
+
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    p = strstr(line, pat);
+    return p != NULL ? p + strlen(pat) : NULL;
+}
+
+/* 
+ * json_string_value:
+ * Decodes the JSON string literal at p (after blanks) into buf, undoing
+ * put_json_string(). Returns 0 if there is none or it does not fit.
+ */                    
+int json_string_value(const char* p, char* buf, size_t len) {
+    size_t n = 0;
+
+    while (p != NULL && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p == NULL || *p++ != '"') {
+        return 0;
+    }
+    for (; *p && *p != '"' && n + 1 < len; p++) {
+        char ch = *p;
+        if (ch == '\\') {
+            ch = *++p;
+            if (ch == 'n') {
+                ch = '\n';
+            } else if (ch == 't') {
+                ch = '\t';
+            } else if (ch == 'u') {
+                unsigned int u = 0;
+                if (sscanf(p + 1, "%4x", &u) != 1) {
+                    return 0;
+                }
+                ch = (char) u;
+                p += 4;
+            } else if (ch == '\0') {
+                return 0;
+            }
+        }
+        buf[n++] = ch;
+    }
+    buf[n] = '\0';
+    return *p == '"';
+}
+
+/* 
+ * bench_baseline_matches:
+ * Checks that the baseline was recorded with the generator settings of
+ * this run (-n, -f and -r), since its counters depend on them. Reports
+ * the difference to stderr and returns 0 if it was not.
+ */                    
+int bench_baseline_matches(FILE* fp) {
+    char line[4096];
+    long count = -1;
+    unsigned long long footprint = 0;
+    unsigned long long seed = 1; //the default of gen_seed, for old baselines
+    const char* p;
+
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp) != NULL && json_field(line, "results") == NULL) {
+        if ((p = json_field(line, "accesses_per_pattern")) != NULL) {
+            count = atol(p);
+        } else if ((p = json_field(line, "footprint")) != NULL) {
+            footprint = strtoull(p, NULL, 10);
+        } else if ((p = json_field(line, "seed")) != NULL) {
+            seed = strtoull(p, NULL, 10);
+        }
+    }
+    if (count != gen_count || footprint != gen_footprint || seed != gen_seed) {
+        fprintf(stderr, "%s: recorded with -n %ld -f %llu -r %llu, this run has "
+                "-n %ld -f %llu -r %llu; not comparing\n", bench_baseline, count, footprint,
+                seed, gen_count, gen_footprint, gen_seed);
+        return 0;
+    }
+    return 1;
+}
+
+/* 
+ * bench_lookup_baseline:
+ * Finds the result line for config/trace in the baseline file and returns
+ * its ns_per_access and counters. Returns 0 if there is no such line.
+ */                    
+int bench_lookup_baseline(FILE* fp, const char* config, const char* trace,
+        double* ns, long* hits, long* misses) {
+    char line[4096];
+    char name[PATH_MAX];
+    const char* p;
+
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (!json_string_value(json_field(line, "config"), name, sizeof(name)) ||
+                strcmp(name, config) != 0 ||
+                !json_string_value(json_field(line, "trace"), name, sizeof(name)) ||
+                strcmp(name, trace) != 0) {
+            continue;
+        }
+        if ((p = json_field(line, "ns_per_access")) == NULL) {
+            continue;
+        }
+        *ns = atof(p);
+        *hits = (p = json_field(line, "hits")) ? atol(p) : -1;
+        *misses = (p = json_field(line, "misses")) ? atol(p) : -1;
+        return 1;
+    }
+    return 0;
+}
+
+/* 
+ * bench_run:
+ * Times one (config, trace) pair and prints it as a JSON object. Exactly one
+ * of tb and trace_fn is used: an in-memory trace measures access_data()
+ * alone, a trace file also measures the parser in replay_trace().
+ * Returns 1 if the run regressed against the baseline.
+ */                    
+int bench_run(bench_config_t* cfg, const char* trace_name, trace_buf_t* tb,
+        char* trace_fn, FILE* base_fp, int first) {
+    double best = 0.0;
+    struct rusage ru;
+    long rss_before;
+
+    //ru_maxrss only ever grows, so report the process peak and this run's
+    //share of it separately: a run that fits under an earlier peak adds 0.
+    getrusage(RUSAGE_SELF, &ru);
+    rss_before = ru.ru_maxrss;
+    memset(&cache, 0, sizeof(cache));
+    cache.s = cfg->s;
+    cache.E = cfg->E;
+    cache.b = 6;
+    for (int rep = 0; rep < BENCH_REPS; rep++) {
+        init_cache(&cache);
+        double start = now_sec();
+        if (tb != NULL) {
+            replay_buffer(tb);
+        } else {
+            replay_trace(trace_fn);
+        }
+        double elapsed = now_sec() - start;
+        free_cache(&cache);
+        if (rep == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    long accesses = cache.hit_cnt + cache.miss_cnt;
+    double ns = accesses ? best * 1e9 / accesses : 0.0;
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("%s    {\"config\":", first ? "" : ",\n");
+    put_json_string(stdout, cfg->name);
+    printf(",\"trace\":");
+    put_json_string(stdout, trace_name);
+    printf(",\"s\":%d,\"E\":%d,\"b\":%d,"
+           "\"accesses\":%ld,\"hits\":%ld,\"misses\":%ld,\"evictions\":%ld,"
+           "\"seconds\":%.6f,\"maccesses_per_s\":%.3f,\"ns_per_access\":%.3f,"
+           "\"process_peak_rss_kb\":%ld,\"peak_rss_growth_kb\":%ld}",
+           cache.s, cache.E, cache.b,
+           accesses, cache.hit_cnt, cache.miss_cnt, cache.evict_cnt, best,
+           best > 0.0 ? accesses / best / 1e6 : 0.0, ns, ru.ru_maxrss,
+           ru.ru_maxrss - rss_before);
+
+    double base_ns;
+    long base_hits, base_misses;
+    if (base_fp == NULL ||
+            !bench_lookup_baseline(base_fp, cfg->name, trace_name,
+                &base_ns, &base_hits, &base_misses)) {
+        return 0;
+    }
+
+    int regressed = 0;
+    if ((base_hits >= 0 && base_hits != cache.hit_cnt) ||
+            (base_misses >= 0 && base_misses != cache.miss_cnt)) {
+        fprintf(stderr, "MISMATCH %s/%s: hits:%ld misses:%ld, baseline hits:%ld misses:%ld\n",
+                cfg->name, trace_name, cache.hit_cnt, cache.miss_cnt, base_hits, base_misses);
+        regressed = 1;
+    }
+    if (base_ns > 0.0 && ns > base_ns * (1.0 + bench_tolerance / 100.0)) {
+        fprintf(stderr, "REGRESSION %s/%s: %.3f ns/access vs %.3f baseline (%+.1f%%)\n",
+                cfg->name, trace_name, ns, base_ns, (ns / base_ns - 1.0) * 100.0);
+        regressed = 1;
+    }
+    return regressed;
+}
+
+/* 
+ * run_bench:
+ * Runs every configuration of the benchmark matrix over the generated
+ * patterns and the given recorded traces, printing JSON to stdout. The
+ * output can be stored and passed back with --baseline to catch throughput
+ * regressions (slower than the tolerance) or changed hit/miss counts.
+ * Returns the process exit status.
+ */                    
+int run_bench(char** traces, int ntraces) {
+    int nconfigs = sizeof(bench_configs) / sizeof(bench_configs[0]);
+    int npatterns = sizeof(bench_patterns) / sizeof(bench_patterns[0]);
+    int regressions = 0;
+    int first = 1;
+    char name[64];
+    FILE* base_fp = NULL;
+
+    if (bench_baseline != NULL) {
+        base_fp = fopen(bench_baseline, "r");
+        if (!base_fp) {
+            fprintf(stderr, "%s: %s\n", bench_baseline, strerror(errno));
+            return 1;
+        }
+        if (!bench_baseline_matches(base_fp)) {
+            fclose(base_fp);
+            return 1;
+        }
+    }
+
+    verbosity = 0;
+    printf("{\n  \"csim_bench\": 1,\n  \"accesses_per_pattern\": %ld,\n"
+           "  \"footprint\": %llu,\n  \"seed\": %llu,\n  \"results\": [\n",
+           gen_count, gen_footprint, gen_seed);
+
+    for (int p = 0; p < npatterns; p++) {
+        trace_buf_t tb = {0};
+        gen_spec = (char*) bench_patterns[p];
+        generate_trace(&tb);
+        snprintf(name, sizeof(name), "gen:%s", bench_patterns[p]);
+        for (int i = 0; i < nconfigs; i++) {
+            regressions += bench_run(&bench_configs[i], name, &tb, NULL, base_fp, first);
+            first = 0;
+        }
+        free_trace(&tb);
+    }
+
+    for (int t = 0; t < ntraces; t++) {
+        for (int i = 0; i < nconfigs; i++) {
+            regressions += bench_run(&bench_configs[i], traces[t], NULL, traces[t],
+                    base_fp, first);
+            first = 0;
+        }
+    }
+
+    printf("\n  ]\n}\n");
+    if (base_fp != NULL) {
+        fclose(base_fp);
+        fprintf(stderr, "%d regression(s) against %s\n", regressions, bench_baseline);
+    }
+    return regressions ? 1 : 0;
+}
+
+
+//Globals for --perf: host hardware counters around each simulator phase.
+int perf_mode = 0; //count host events per phase if set
+
+//Phases of a --perf run, in output order.
+enum { PHASE_PARSE, PHASE_ACCESS, PHASE_SUMMARY, NUM_PHASES };
+const char* perf_phase_names[NUM_PHASES] = {"parse", "access", "summary"};
+
+//Type perf_desc_t: One host event counted by --perf.
+typedef struct perf_desc {
+    const char* name;
+    unsigned int type;
+    unsigned long long config;
+} perf_desc_t;
+
+#define NUM_PERF_EVENTS 4
+perf_desc_t perf_events[NUM_PERF_EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int perf_fds[NUM_PERF_EVENTS]; //-1 if the event could not be opened
+double perf_counts[NUM_PHASES][NUM_PERF_EVENTS];
+
+/* 
+ * perf_open:
+ * Opens one disabled user-space counter per event for this thread. Events
+ * the host or its perf_event_paranoid setting refuses are reported and
+ * skipped rather than failing the run.
+ */                    
+void perf_open() {
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        perf_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf_fds[i] < 0) {
+            fprintf(stderr, "perf: %s unavailable: %s\n", perf_events[i].name,
+                    strerror(errno));
+        }
+    }
+}
+
+/* 
+ * perf_begin:
+ * Zeroes and starts all open counters at the start of a phase.
+ */                    
+void perf_begin() {
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/* 
+ * perf_end:
+ * Stops all open counters and stores their values for the given phase,
+ * scaled up if the kernel had to multiplex them.
+ */                    
+void perf_end(int phase) {
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        unsigned long long val[3];
+
+        perf_counts[phase][i] = -1.0;
+        if (perf_fds[i] < 0) {
+            continue;
+        }
+        ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf_fds[i], val, sizeof(val)) != sizeof(val) || val[2] == 0) {
+            continue;
+        }
+        perf_counts[phase][i] = (double) val[0] * val[1] / val[2];
+    }
+}
+
+/* 
+ * perf_report:
+ * Prints the counters of every phase as ratios per simulated access to
+ * stderr, so the regular summary on stdout stays unchanged.
+ */                    
+void perf_report(long accesses) {
+    if (accesses == 0) {
+        accesses = 1;
+    }
+
+    fprintf(stderr, "perf: %ld accesses\n", accesses);
+    fprintf(stderr, "perf: %-8s %14s %14s %8s %14s %14s\n", "phase", "cycles/acc",
+            "instr/acc", "IPC", "llc-miss/acc", "br-miss/acc");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        double* v = perf_counts[p];
+        fprintf(stderr, "perf: %-8s", perf_phase_names[p]);
+        for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+            if (v[i] < 0.0) {
+                fprintf(stderr, " %14s", "n/a");
+            } else {
+                fprintf(stderr, " %14.3f", v[i] / accesses);
+            }
+            if (i == 1) {
+                if (v[0] > 0.0 && v[1] >= 0.0) {
+                    fprintf(stderr, " %8.3f", v[1] / v[0]);
+                } else {
+                    fprintf(stderr, " %8s", "n/a");
+                }
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        if (perf_fds[i] >= 0) {
+            close(perf_fds[i]);
+        }
+    }
+}
+
+
+/*
+ * print_usage:
+ * Print information on how to use csim to standard output.
+ */                    
+void print_usage(char* argv[]) {                 
+	printf("Usage: %s [-hv] -s <num> -E <num> -b <num> (-t <file> | -g <pattern>)\n", argv[0]);
+	printf("Options:\n");
+	printf("  -h         Print this help message.\n");
+	printf("  -v         Verbose flag.\n");
+	printf("  -s <num>   Number of s bits for set index.\n");
+	printf("  -E <num>   Number of lines per set.\n");
+	printf("  -b <num>   Number of b bits for word and byte offsets.\n");
+	printf("  -t <file>  Trace file.\n");
+	printf("  -g <pat>   Replay a generated trace instead: seq, strided[:bytes],\n");
+	printf("             random, zipf[:theta], chase[:bytes] or matmul[:tile].\n");
+	printf("  -n <num>   Number of generated accesses (default 1000000).\n");
+	printf("  -f <size>  Generated footprint in bytes, K/M/G suffix ok (default 16M).\n");
+	printf("  -r <num>   Generator seed (default 1).\n");
+	printf("  -o <file>  Write all output to <file>; no .csim_results is written.\n");
+	printf("  --format <fmt>       Summary as text (default), json or csv, with\n");
+	printf("                       the configuration, all counters and timing.\n");
+	printf("  --batch <manifest>   Run the jobs of a manifest, one per line:\n");
+	printf("                       <trace> <s> <E> <b> [index=fn] [sets=n] [slices=n]\n");
+	printf("                       [victim=n] [miss-cache=n] [policy=name] [reuse]\n");
+	printf("  -j <num>             Worker threads for --batch, --ir-cache and\n");
+	printf("                       --two-phase (default 1).\n");
+	printf("  --check-decoder <n>  Fuzz the trace line decoder against sscanf() on\n");
+	printf("                       n random inputs (-r sets the seed).\n");
+	printf("  --bench [trace...]   Run the throughput benchmark matrix, JSON output.\n");
+	printf("  --baseline <file>    Compare --bench against a stored JSON result.\n");
+	printf("  --tolerance <pct>    Allowed ns/access slowdown (default 10).\n");
+	printf("  --perf               Count host cycles, instructions, LLC and branch\n");
+	printf("                       misses per phase (parse/access/summary).\n");
+	printf("  --page-map <map>     Translate addresses before the cache: identity,\n");
+	printf("                       random, color or pagemap:<file>[@<hex vaddr>].\n");
+	printf("  --page-size <size>   Page size for --page-map (default 4K).\n");
+	printf("  --phys-mem <size>    Physical memory for --page-map (default 16G).\n");
+	printf("  --index <fn>         Set index function: mask (default), xor, complex\n");
+	printf("                       (Intel slice hash) or mod.\n");
+	printf("  --sets <num>         Sets per slice, need not be a power of two\n");
+	printf("                       (replaces -s).\n");
+	printf("  --slices <num>       Number of LLC slices (default 1).\n");
+	printf("  --victim <num>       Attach a fully-associative victim cache.\n");
+	printf("  --miss-cache <num>   Attach a fully-associative miss cache.\n");
+	printf("  --icache <s,E,b>     Simulate \"I\" records in a separate L1I cache.\n");
+	printf("  --l2 <s,E,b>         Shared L2 behind the L1D (and L1I).\n");
+	printf("  --reuse              Report dead blocks, line lifetimes and hits per fill.\n");
+	printf("  --regions <file>     Attribute L1 hits/misses/evictions to named\n");
+	printf("                       ranges, one \"<name> <start> <end>\" per line.\n");
+	printf("  --elf-symbols <file>[@<hex bias>]\n");
+	printf("                       Add the data and function symbols of an ELF file.\n");
+	printf("  --heap-log <file>    Add heap blocks, one \"<site> <addr> <size>\" per line.\n");
+	printf("  --region-filter      Only simulate accesses inside a region.\n");
+	printf("  --policy <name>      Replacement policy: lru (default), lip, bip, dip,\n");
+	printf("                       srrip, brrip or drrip (dip/drrip use set dueling).\n");
+	printf("  --duel-epoch <n>     Accesses per epoch of the dueling timeline (65536).\n");
+	printf("  --bloom              Rule out misses with per-set counting Bloom\n");
+	printf("                       filters and keep LRU order in lists (lru only;\n");
+	printf("                       for very high associativity, same results).\n");
+	printf("  --timing             Estimate cycles and memory-level parallelism:\n");
+	printf("  --mshrs <n>            outstanding misses (default 8),\n");
+	printf("  --issue-gap <n>        cycles between trace records (default 1),\n");
+	printf("  --hit-latency <n>      L1 hit latency (default 4),\n");
+	printf("  --l2-latency <n>       L2 hit latency with --l2 (default 12),\n");
+	printf("  --mem-latency <n>      unloaded memory latency (default 200),\n");
+	printf("  --mem-bandwidth <x>    bytes per cycle, fills queue for it (default\n");
+	printf("                         unlimited, i.e. fixed latency).\n");
+	printf("  --hugepages <mode>   Back caches of 2M+ of lines with huge pages:\n");
+	printf("                       thp (default), hugetlb (falls back to thp) or off.\n");
+	printf("  --kv <policy>        Key-value mode: -t has \"<key>,<size>\" records,\n");
+	printf("                       policy lru, arc, lirs or tinylfu (W-TinyLFU).\n");
+	printf("  --kv-capacity <size> Capacity in bytes for --kv, K/M/G suffix ok.\n");
+	printf("  --shards <rate>      Sampled miss-ratio curve of a fully-associative\n");
+	printf("                       LRU cache over all sizes (needs only -b).\n");
+	printf("  --shards-max <n>     Track at most n sampled blocks, lowering the\n");
+	printf("                       rate as needed (fixed memory).\n");
+	printf("  --ir-cache <dir>     Replay from per-set tag streams stored in dir,\n");
+	printf("                       built on first use (lru, lip or srrip, L1 only).\n");
+	printf("  --two-phase          Bucket the trace by set in parallel, then replay\n");
+	printf("                       the sets in parallel (same limits as --ir-cache).\n");
+	printf("  --sectors <n>        Split lines into n sectors filled on demand and\n");
+	printf("                       count sector misses apart from tag misses.\n");
+	printf("  --compress <ratio>   Compressed sets: 2 tags per line of data space,\n");
+	printf("                       block sizes hashed around B / ratio.\n");
+	printf("  --cores <t1,t2,..>   Co-run one trace per core: private L1 (-s -E -b)\n");
+	printf("                       and L2 (--l2), shared LLC (--llc, --policy);\n");
+	printf("                       compares LLC replacement without and with hints.\n");
+	printf("  --llc <s,E,b>        Geometry of the shared LLC for --cores.\n");
+	printf("  --diff-test <n>      Compare the optimized engines with access_data()\n");
+	printf("                       on n random configurations (seed -r), then exit.\n");
+	printf("  --progress <sec>     Report progress, accesses/s, miss ratio and ETA\n");
+	printf("                       of a -t replay to stderr every sec seconds.\n");
+	printf("  --compact <out>      Write -t with repeated sequences of -b sized\n");
+	printf("                       blocks folded into loop records, then exit.\n");
+	printf("                       The result only replays with blocks of that\n");
+	printf("                       size or larger, no --sectors, aligned regions.\n");
+	printf("\nExamples:\n");
+	printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", argv[0]);
+	printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", argv[0]);
+	printf("  linux>  %s -s 10 -E 8 -b 6 -g zipf:0.9 -f 64M\n", argv[0]);
+	printf("  linux>  %s --bench --baseline bench.json traces/long.trace\n", argv[0]);
+	exit(0);
+}  
+
+
+//Globals for machine-readable output (--format, -o).
+enum { FMT_TEXT, FMT_JSON, FMT_CSV };
+int out_format = FMT_TEXT; //summary format
+char* out_path = NULL; //write all output here instead of stdout
+
+//Names for the configuration fields of a result.
+const char* index_names[] = {"mask", "xor", "complex", "mod"};
+const char* page_map_names[] = {"identity", "random", "color", "pagemap"};
+
+//Maximum number of fields of one result record.
+#define MAX_FIELDS 96
+
+//Type field_t: One named value of a result record. Values are kept as
+//text; "quote" marks strings, and "list" JSON arrays that CSV leaves out.
+//Values too long for val are kept on the heap in ext instead.
+typedef struct field {
+    char key[40];
+    char val[600];
+    char* ext;
+    char quote;
+    char list;
+} field_t;
+
+//Type result_t: The configuration, counters and timing of one simulation.
+typedef struct result {
+    field_t f[MAX_FIELDS];
+    int n;
+} result_t;
+
+/* 
+ * add_field:
+ * Appends a field to a result record, formatted with printf rules.
+ */                    
+void add_field(result_t* r, const char* key, int quote, const char* fmt, ...) {
+    va_list ap;
+
+    if (r->n == MAX_FIELDS) {
+        return;
+    }
+    snprintf(r->f[r->n].key, sizeof(r->f[r->n].key), "%s", key);
+    va_start(ap, fmt);
+    int len = vsnprintf(r->f[r->n].val, sizeof(r->f[r->n].val), fmt, ap);
+    va_end(ap);
+    r->f[r->n].ext = NULL;
+    if (len >= (int) sizeof(r->f[r->n].val)) {
+        r->f[r->n].ext = malloc(len + 1);
+        if (r->f[r->n].ext == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        va_start(ap, fmt);
+        vsnprintf(r->f[r->n].ext, len + 1, fmt, ap);
+        va_end(ap);
+    }
+    r->f[r->n].quote = quote;
+    r->f[r->n].list = 0;
+    r->n++;
+}
+
+/* 
+ * free_result:
+ * Frees the long values of a result record and empties it.
+ */                    
+void free_result(result_t* r) {
+    for (int i = 0; i < r->n; i++) {
+        free(r->f[i].ext);
+        r->f[i].ext = NULL;
+    }
+    r->n = 0;
+}
+
+/* 
+ * add_histogram:
+ * Appends a histogram as a JSON array field.
+ */                    
+void add_histogram(result_t* r, const char* key, long* hist, int n) {
+    char* buf = malloc(n * 22 + 3);
+    int len = 0;
+
+    if (buf == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    buf[len++] = '[';
+    for (int i = 0; i < n; i++) {
+        len += sprintf(buf + len, "%s%ld", i ? "," : "", hist[i]);
+    }
+    buf[len++] = ']';
+    buf[len] = '\0';
+    add_field(r, key, 0, "%s", buf);
+    r->f[r->n - 1].list = 1;
+    free(buf);
+}
+
+/* 
+ * add_regions:
+ * Appends the per-region counters of all (already sorted) regions with
+ * accesses as a JSON array of objects.
+ */                    
+void add_regions(result_t* r) {
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* fp = open_memstream(&buf, &size);
+    int n = 0;
+
+    if (fp == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    fputc('[', fp);
+    for (int i = 0; i <= num_region_names; i++) {
+        region_stats_t* rs = &region_stats[i];
+
+        if (rs->hits + rs->misses == 0) {
+            continue;
+        }
+        fprintf(fp, "%s{\"name\":", n++ ? "," : "");
+        put_json_string(fp, rs->name);
+        fprintf(fp, ",\"hits\":%ld,\"misses\":%ld,\"evictions\":%ld}",
+                rs->hits, rs->misses, rs->evictions);
+    }
+    fputc(']', fp);
+    fclose(fp);
+    add_field(r, "regions", 0, "%s", buf);
+    r->f[r->n - 1].list = 1;
+    free(buf);
+}
+
+/* 
+ * add_cache_fields:
+ * Appends the geometry and counters of cache c, with keys prefixed by
+ * "prefix" (e.g. "l2_").
+ */                    
+void add_cache_fields(result_t* r, const char* prefix, cache_t* c) {
+    char key[40];
+
+#define CACHE_FIELD(name, fmt, val) \
+    snprintf(key, sizeof(key), "%s%s", prefix, name); \
+    add_field(r, key, 0, fmt, val)
+
+    CACHE_FIELD("s", "%d", c->s);
+    CACHE_FIELD("E", "%d", c->E);
+    CACHE_FIELD("b", "%d", c->b);
+    CACHE_FIELD("sets", "%d", c->S);
+    CACHE_FIELD("hits", "%ld", c->hit_cnt);
+    CACHE_FIELD("misses", "%ld", c->miss_cnt);
+    CACHE_FIELD("evictions", "%ld", c->evict_cnt);
+#undef CACHE_FIELD
+}
+
+/* 
+ * collect_cache_result:
+ * Fills r with the configuration and counters of cache c (including its
+ * victim buffer and reuse statistics) and the replay time.
+ */                    
+void collect_cache_result(result_t* r, const char* trace_name, cache_t* c,
+        double seconds) {
+    long accesses = c->hit_cnt + c->miss_cnt;
+
+    r->n = 0;
+    add_field(r, "trace", 1, "%s", trace_name);
+    add_cache_fields(r, "", c);
+    add_field(r, "slices", 0, "%d", c->slices);
+    add_field(r, "index", 1, "%s", index_names[c->index_fn]);
+    add_field(r, "line_backing", 1, "%s", backing_names[c->backing]);
+    add_field(r, "seconds", 0, "%.6f", seconds);
+    add_field(r, "accesses_per_s", 0, "%.0f", seconds > 0.0 ? accesses / seconds : 0.0);
+
+    if (c->sector_bits > 0) {
+        add_field(r, "sectors", 0, "%d", 1 << c->sector_bits);
+        add_field(r, "sector_misses", 0, "%ld", c->sector_miss_cnt);
+    }
+    if (c->compress_ratio > 0.0) {
+        long fills = c->miss_cnt - c->sector_miss_cnt;
+        add_field(r, "compress_ratio", 0, "%.2f", c->compress_ratio);
+        add_field(r, "data_ways", 0, "%d", c->data_ways);
+        add_field(r, "avg_segments", 0, "%.3f", fills ? (double) c->fill_segs / fills : 0.0);
+        add_field(r, "space_evictions", 0, "%ld", c->space_evict_cnt);
+    }
+    if (c->vc_kind != VC_NONE) {
+        add_field(r, "vc_kind", 1, "%s", c->vc_kind == VC_VICTIM ? "victim" : "miss");
+        add_field(r, "vc_size", 0, "%d", c->vc_size);
+        add_field(r, "vc_hits", 0, "%ld", c->vc_hit_cnt);
+        add_field(r, "vc_inserts", 0, "%ld", c->vc_insert_cnt);
+        add_field(r, "vc_evictions", 0, "%ld", c->vc_evict_cnt);
+    }
+    if (c->policy != POLICY_LRU) {
+        add_field(r, "policy", 1, "%s", policy_names[c->policy]);
+    }
+    if (c->duel != NULL) {
+        duel_t* d = c->duel;
+        add_field(r, "psel", 0, "%d", d->psel);
+        add_field(r, "leader_misses_a", 0, "%ld", d->leader_miss[0]);
+        add_field(r, "leader_misses_b", 0, "%ld", d->leader_miss[1]);
+        add_field(r, "follower_misses_a", 0, "%ld", d->follower_miss[0]);
+        add_field(r, "follower_misses_b", 0, "%ld", d->follower_miss[1]);
+        add_field(r, "epochs_won_a", 0, "%ld", d->epochs_won[0]);
+        add_field(r, "epochs_won_b", 0, "%ld", d->epochs_won[1]);
+    }
+    if (c->reuse != NULL) {
+        reuse_stats_t* ru = c->reuse;
+        add_field(r, "reuse_evicted", 0, "%ld", ru->evicted);
+        add_field(r, "reuse_dead", 0, "%ld", ru->dead);
+        add_field(r, "reuse_hits_per_fill", 0, "%.4f",
+                ru->evicted ? (double) ru->total_hits / ru->evicted : 0.0);
+        add_field(r, "reuse_resident", 0, "%ld", ru->resident);
+        add_field(r, "reuse_resident_dead", 0, "%ld", ru->resident_dead);
+        add_histogram(r, "reuse_hits_per_fill_log2", ru->hits_per_fill, REUSE_BUCKETS);
+        add_histogram(r, "reuse_lifetime_log2", ru->lifetime, REUSE_BUCKETS);
+        add_histogram(r, "reuse_dead_time_log2", ru->dead_time, REUSE_BUCKETS);
+    }
+}
+
+/* 
+ * collect_result:
+ * Fills r with everything a run produced: the configuration, all counters
+ * of the enabled features, and the replay time.
+ */                    
+void collect_result(result_t* r, const char* trace_name, double seconds) {
+    collect_cache_result(r, trace_name, &cache, seconds);
+    add_field(r, "page_map", 1, "%s", page_map_names[page_map]);
+    if (split_i) {
+        add_cache_fields(r, "l1i_", &icache);
+    }
+    if (use_l2) {
+        add_cache_fields(r, "l2_", &l2cache);
+        add_field(r, "l2_data_hits", 0, "%ld", l2_stream_hits[STREAM_DATA]);
+        add_field(r, "l2_data_misses", 0, "%ld", l2_stream_misses[STREAM_DATA]);
+        add_field(r, "l2_inst_hits", 0, "%ld", l2_stream_hits[STREAM_INST]);
+        add_field(r, "l2_inst_misses", 0, "%ld", l2_stream_misses[STREAM_INST]);
+    }
+    if (loop_iters_skipped) {
+        add_field(r, "loop_iterations_skipped", 0, "%ld", loop_iters_skipped);
+    }
+    if (timing) {
+        add_field(r, "cycles", 0, "%ld", timing_cycles());
+        add_field(r, "amat", 0, "%.3f",
+                timed_accesses ? (double) total_latency / timed_accesses : 0.0);
+        add_field(r, "mlp", 0, "%.3f", timing_mlp());
+        add_field(r, "mshrs", 0, "%d", num_mshrs);
+        add_field(r, "mshr_merges", 0, "%ld", mshr_merges);
+        add_field(r, "mshr_full_stalls", 0, "%ld", mshr_stalls);
+        add_field(r, "stall_cycles", 0, "%ld", stall_cycles);
+        add_field(r, "mem_requests", 0, "%ld", mem_requests);
+        add_field(r, "avg_mem_latency", 0, "%.1f",
+                mem_requests ? (double) mem_cycles / mem_requests : 0.0);
+    }
+    if (num_region_names > 0) {
+        add_regions(r);
+    }
+}
+
+/* 
+ * write_result:
+ * Writes r as one JSON object per line, or as a CSV row (preceded by a
+ * header row if "header" is set). JSON arrays are left out of CSV.
+ */                    
+void write_result(FILE* fp, result_t* r, int format, int header) {
+    if (format == FMT_JSON) {
+        fprintf(fp, "{");
+        for (int i = 0; i < r->n; i++) {
+            fprintf(fp, "%s\"%s\":", i ? "," : "", r->f[i].key);
+            const char* val = r->f[i].ext ? r->f[i].ext : r->f[i].val;
+            if (r->f[i].quote) {
+                put_json_string(fp, val);
+            } else {
+                fputs(val, fp);
+            }
+        }
+        fprintf(fp, "}\n");
+        return;
+    }
+
+    int first = 1;
+    if (header) {
+        for (int i = 0; i < r->n; i++) {
+            if (!r->f[i].list) {
+                fprintf(fp, "%s%s", first ? "" : ",", r->f[i].key);
+                first = 0;
+            }
+        }
+        fprintf(fp, "\n");
+        first = 1;
+    }
+    for (int i = 0; i < r->n; i++) {
+        if (!r->f[i].list) {
+            fputs(first ? "" : ",", fp);
+            put_csv_field(fp, r->f[i].ext ? r->f[i].ext : r->f[i].val);
+            first = 0;
+        }
+    }
+    fprintf(fp, "\n");
+}
+
+
+/*
+ * print_summary:
+ * Prints a summary of the cache simulation statistics to a file.
+ * The .csim_results side file is only written by plain runs (no --format
+ * or -o), where the test_csim driver expects it.
+ */                    
+void print_summary(long hits, long misses, long evictions) {                
+	printf("hits:%ld misses:%ld evictions:%ld\n", hits, misses, evictions);
+	if (out_format != FMT_TEXT || out_path != NULL) {
+		return;
+	}
+	FILE* output_fp = fopen(".csim_results", "w");
+	assert(output_fp);
+	fprintf(output_fp, "%ld %ld %ld\n", hits, misses, evictions);
+	fclose(output_fp);
+}  
+
+
+/*
+ * parse_geometry:
+ * Reads an "s,E,b" triple for an additional cache level.
+ */                    
+void parse_geometry(char* prog, char* arg, cache_t* c) {
+	if (sscanf(arg, "%d,%d,%d", &c->s, &c->E, &c->b) != 3 ||
+			c->s < 0 || c->E < 1 || c->b < 0) {
+		printf("%s: Invalid cache geometry: %s (expected s,E,b)\n", prog, arg);
+		exit(1);
+	}
+}
+
+
+/*
+ * print_level_summary:
+ * Prints the statistics of the L1I and L2 in split I/D mode, and how many
+ * loop iterations of a compacted trace were skipped.
+ */                    
+void print_level_summary() {
+	if (split_i) {
+		printf("L1I hits:%ld misses:%ld evictions:%ld\n",
+				icache.hit_cnt, icache.miss_cnt, icache.evict_cnt);
+	}
+	if (use_l2) {
+		printf("L2 hits:%ld misses:%ld evictions:%ld\n",
+				l2cache.hit_cnt, l2cache.miss_cnt, l2cache.evict_cnt);
+		printf("L2 data hits:%ld misses:%ld\n",
+				l2_stream_hits[STREAM_DATA], l2_stream_misses[STREAM_DATA]);
+		if (split_i) {
+			printf("L2 inst hits:%ld misses:%ld\n",
+					l2_stream_hits[STREAM_INST], l2_stream_misses[STREAM_INST]);
+		}
+	}
+	if (loop_iters_skipped) {
+		printf("loop-iterations-skipped:%ld\n", loop_iters_skipped);
+	}
+}
+
+
+/*
+ * print_histogram:
+ * Prints one log2 histogram of the reuse report, skipping empty buckets.
+ * Bucket 0 holds zeros, bucket k holds [2^(k-1), 2^k).
+ */                    
+void print_histogram(const char* name, long* hist) {
+	printf("reuse: %s", name);
+	for (int i = 0; i < REUSE_BUCKETS; i++) {
+		if (hist[i] == 0) {
+			continue;
+		}
+		if (i == 0) {
+			printf(" 0:%ld", hist[i]);
+		} else if (i == 1) {
+			printf(" 1:%ld", hist[i]);
+		} else {
+			printf(" %ld-%ld:%ld", 1L << (i - 1), (1L << i) - 1, hist[i]);
+		}
+	}
+	printf("\n");
+}
+
+
+/*
+ * print_reuse_summary:
+ * Prints the dead-block and line lifetime report of cache c (--reuse).
+ * Lifetimes and dead times are measured in accesses to the cache.
+ */                    
+void print_reuse_summary(cache_t* c) {
+	reuse_stats_t* r = c->reuse;
+
+	if (r == NULL) {
+		return;
+	}
+	printf("reuse: evicted:%ld dead-on-arrival:%ld (%.1f%%) hits-per-fill:%.2f\n",
+			r->evicted, r->dead, r->evicted ? 100.0 * r->dead / r->evicted : 0.0,
+			r->evicted ? (double) r->total_hits / r->evicted : 0.0);
+	print_histogram("hits-per-fill", r->hits_per_fill);
+	print_histogram("lifetime", r->lifetime);
+	print_histogram("dead-time", r->dead_time);
+	printf("reuse: resident-at-end:%ld never-hit:%ld\n", r->resident, r->resident_dead);
+}
+
+
+/*
+ * print_vc_summary:
+ * Prints the side buffer statistics of cache c, if it has one.
+ */                    
+void print_vc_summary(cache_t* c) {
+	if (c->vc_kind == VC_NONE) {
+		return;
+	}
+	printf("%s-hits:%ld %s-inserts:%ld %s-evictions:%ld\n",
+			c->vc_kind == VC_VICTIM ? "victim" : "miss-cache", c->vc_hit_cnt,
+			c->vc_kind == VC_VICTIM ? "victim" : "miss-cache", c->vc_insert_cnt,
+			c->vc_kind == VC_VICTIM ? "victim" : "miss-cache", c->vc_evict_cnt);
+}
+
+
+/*
+ * print_sector_summary:
+ * Prints the sector and compression statistics of cache c, if enabled.
+ */                    
+void print_sector_summary(cache_t* c) {
+	if (c->sector_bits > 0) {
+		printf("sectors:%d tag-misses:%ld sector-misses:%ld\n", 1 << c->sector_bits,
+				c->miss_cnt - c->sector_miss_cnt, c->sector_miss_cnt);
+	}
+	if (c->compress_ratio > 0.0) {
+		long fills = c->miss_cnt - c->sector_miss_cnt;
+		printf("compression: data-ways:%d tags:%d avg-segments:%.2f/%d space-evictions:%ld\n",
+				c->data_ways, c->E, fills ? (double) c->fill_segs / fills : 0.0,
+				COMPRESS_SEGS, c->space_evict_cnt);
+	}
+}
+
+
+/*
+ * print_timing_summary:
+ * Prints the estimates of the timing model (--timing).
+ */                    
+void print_timing_summary() {
+	printf("timing: cycles:%ld accesses:%ld amat:%.2f mlp:%.2f\n",
+			timing_cycles(), timed_accesses,
+			timed_accesses ? (double) total_latency / timed_accesses : 0.0, timing_mlp());
+	printf("timing: mshr-merges:%ld mshr-full-stalls:%ld stall-cycles:%ld "
+			"mem-requests:%ld avg-mem-latency:%.1f\n",
+			mshr_merges, mshr_stalls, stall_cycles, mem_requests,
+			mem_requests ? (double) mem_cycles / mem_requests : 0.0);
+}
+
+
+/*
+ * print_policy_summary:
+ * Prints the replacement policy of cache c unless it is plain LRU. For
+ * DIP and DRRIP also the PSEL state, the misses of leaders and followers
+ * per component policy, and the winner over time, run-length encoded in
+ * epochs (at most 64 runs are shown).
+ */                    
+void print_policy_summary(cache_t* c) {
+	duel_t* d = c->duel;
+
+	if (c->policy == POLICY_LRU) {
+		return;
+	}
+	printf("policy:%s", policy_names[c->policy]);
+	if (d == NULL) {
+		printf("\n");
+		return;
+	}
+	const char* a = policy_names[d->policy[0]];
+	const char* b = policy_names[d->policy[1]];
+	printf(" psel:%d/%d leader-misses %s:%ld %s:%ld follower-misses %s:%ld %s:%ld\n",
+			d->psel, PSEL_MAX, a, d->leader_miss[0], b, d->leader_miss[1],
+			a, d->follower_miss[0], b, d->follower_miss[1]);
+	printf("policy-epochs (%ld accesses each) %s:%ld %s:%ld\n",
+			d->epoch_len, a, d->epochs_won[0], b, d->epochs_won[1]);
+	printf("policy-timeline:");
+	for (int i = 0; i < d->runs && i < 64; i++) {
+		printf(" %s*%ld", policy_names[d->policy[d->timeline[i].winner]],
+				d->timeline[i].epochs);
+	}
+	printf("%s\n", d->runs > 64 ? " ..." : "");
+}
+
+
+/*
+ * region_by_misses:
+ * qsort() order of region statistics, most misses first.
+ */                    
+int region_by_misses(const void* a, const void* b) {
+	const region_stats_t* x = a;
+	const region_stats_t* y = b;
+
+	if (x->misses != y->misses) {
+		return x->misses > y->misses ? -1 : 1;
+	}
+	return (y->hits > x->hits) - (y->hits < x->hits);
+}
+
+
+/*
+ * print_region_summary:
+ * Prints the L1 hits, misses and evictions of every region that was
+ * accessed, most misses first, with unattributed accesses as "[other]".
+ */                    
+void print_region_summary() {
+	for (int i = 0; i <= num_region_names; i++) {
+		region_stats_t* r = &region_stats[i];
+		long accesses = r->hits + r->misses;
+
+		if (accesses == 0) {
+			continue;
+		}
+		printf("region %s hits:%ld misses:%ld evictions:%ld miss-rate:%.1f%%\n",
+				r->name, r->hits, r->misses, r->evictions, 100.0 * r->misses / accesses);
+	}
+}
+
+
+/*
+ * report_mrc:
+ * Prints the sampled miss-ratio curve of a --shards pass: the estimated
+ * miss ratio of a fully-associative LRU cache of every power-of-two size
+ * up to the largest measured reuse distance.
+ */                    
+void report_mrc(char* trace_name, double seconds) {
+	double max_blocks = mrc_max_blocks();
+
+	if (out_format != FMT_TEXT) {
+		static result_t r;
+		char buf[600];
+		int len = 0;
+
+		buf[len++] = '[';
+		for (double blocks = 1.0; blocks <= max_blocks && len < (int) sizeof(buf) - 16; blocks *= 2.0) {
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%.5f", len > 1 ? "," : "",
+					mrc_miss_ratio(blocks));
+		}
+		buf[len++] = ']';
+		buf[len] = '\0';
+		r.n = 0;
+		add_field(&r, "trace", 1, "%s", trace_name);
+		add_field(&r, "b", 0, "%d", b);
+		add_field(&r, "accesses", 0, "%ld", shards_refs);
+		add_field(&r, "sampled", 0, "%ld", shards_clock);
+		add_field(&r, "shards_rate", 0, "%.8f", shards_current_rate());
+		add_field(&r, "tracked_blocks", 0, "%d", shards_count);
+		add_field(&r, "seconds", 0, "%.6f", seconds);
+		add_field(&r, "mrc_first_size", 0, "%d", 1 << b);
+		add_field(&r, "mrc_miss_ratio", 0, "%s", buf);
+		r.f[r.n - 1].list = 1;
+		write_result(stdout, &r, out_format, 1);
+		return;
+	}
+
+	printf("shards: accesses:%ld sampled:%ld rate:%.6f tracked-blocks:%d\n",
+			shards_refs, shards_clock, shards_current_rate(), shards_count);
+	for (double blocks = 1.0; blocks <= max_blocks; blocks *= 2.0) {
+		printf("mrc: size:%.0f miss-ratio:%.5f\n", ldexp(blocks, b), mrc_miss_ratio(blocks));
+	}
+}
+
+
+/*
+ * report_results:
+ * Prints the statistics of a finished run, as text or as a JSON/CSV
+ * record with the configuration and timing.
+ */                    
+void report_results(char* trace_name, double seconds) {
+	if (num_region_names > 0) {
+		qsort(region_stats, num_region_names + 1, sizeof(region_stats_t), region_by_misses);
+	}
+	if (out_format != FMT_TEXT) {
+		static result_t r;
+		collect_result(&r, trace_name, seconds);
+		write_result(stdout, &r, out_format, 1);
+		free_result(&r);
+		return;
+	}
+
+	//Print the statistics to a file.
+	//DO NOT REMOVE: This function must be called for test_csim to work.
+	print_summary(cache.hit_cnt, cache.miss_cnt, cache.evict_cnt);
+	print_vc_summary(&cache);
+	print_sector_summary(&cache);
+	print_level_summary();
+	print_reuse_summary(&cache);
+	print_policy_summary(&cache);
+	if (timing) {
+		print_timing_summary();
+	}
+	if (num_region_names > 0) {
+		print_region_summary();
+	}
+}
+
+
+//Policies of the key-value cache mode (--kv).
+enum { KV_LRU, KV_ARC, KV_LIRS, KV_TINYLFU, NUM_KV_POLICIES };
+const char* kv_policy_names[] = {"lru", "arc", "lirs", "tinylfu"};
+
+//Lists of the key-value cache. Their role depends on the policy:
+//  lru:     KV_L0 = all objects
+//  arc:     KV_L0/KV_L1 = T1/T2 (seen once/more), KV_L2/KV_L3 = ghosts B1/B2
+//  lirs:    KV_L0 = stack S, KV_L1 = resident HIR queue Q, KV_L2 = ghosts
+//  tinylfu: KV_L0 = window, KV_L1 = probation, KV_L2 = protected
+//The LIRS queue and ghost list use the second set of links of an entry,
+//since an entry can be on the stack at the same time.
+enum { KV_L0, KV_L1, KV_L2, KV_L3, KV_LISTS };
+
+//Type kv_entry_t: One object (or ghost) of the key-value cache.
+typedef struct kv_entry {
+    unsigned long long key;
+    unsigned int size;
+    signed char list; //KV_L* list on the first links, -1 if none
+    signed char qlist; //list on the second links (LIRS), -1 if none
+    char lir; //LIRS: in the LIR set
+    int prev, next; //first links, head = most recent
+    int qprev, qnext; //second links
+    int hnext; //hash chain, or free list
+} kv_entry_t;
+
+//Type kv_list_t: A doubly linked list of entries with its total size.
+typedef struct kv_list {
+    int head;
+    int tail;
+    long long bytes;
+} kv_list_t;
+
+//Type kv_cache_t: A cache of variable-sized objects with a capacity in
+//bytes, the key-value counterpart of cache_t. Entries live in one pool
+//and are found by a chained hash table on the key.
+typedef struct kv_cache {
+    int policy; //KV_* policy
+    long long capacity; //bytes
+    long long used; //bytes of resident objects
+    kv_entry_t* pool;
+    int pool_cap;
+    int pool_used; //entries ever taken from the pool
+    int free_head; //recycled entries, chained by hnext
+    int count; //entries in the hash table, ghosts included
+    int* buckets;
+    int nbuckets; //power of two
+    kv_list_t lists[KV_LISTS];
+
+    long long arc_p; //ARC: target size of T1 in bytes
+    long long lir_bytes; //LIRS: bytes in the LIR set
+    unsigned char* sketch; //TinyLFU: count-min sketch, KV_SKETCH_ROWS rows
+    long sketch_adds; //increments since the last ageing
+
+    //Statistics.
+    long requests;
+    long hits;
+    long misses;
+    long evictions;
+    long bypassed; //objects larger than the whole cache
+    long long bytes_requested;
+    long long bytes_hit;
+    long long bytes_evicted;
+} kv_cache_t;
+
+#define KV_SKETCH_ROWS 4
+#define KV_SKETCH_WIDTH (1 << 20) //counters per row, a power of two
+#define KV_SKETCH_MAX 15 //4-bit counters, as in W-TinyLFU
+
+/* 
+ * kv_hash:
+ * Returns the FNV-1a hash of a key string of n bytes.
+ */                    
+unsigned long long kv_hash(const char* p, size_t n) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (unsigned char) p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* 
+ * kv_bucket:
+ * Returns the hash bucket of a key.
+ */                    
+int kv_bucket(kv_cache_t* kv, unsigned long long key) {
+    return (int) (((key ^ (key >> 31)) * 0x9E3779B97F4A7C15ULL) >> 32) & (kv->nbuckets - 1);
+}
+
+/* 
+ * kv_find:
+ * Returns the entry of key, or -1.
+ */                    
+int kv_find(kv_cache_t* kv, unsigned long long key) {
+    for (int i = kv->buckets[kv_bucket(kv, key)]; i >= 0; i = kv->pool[i].hnext) {
+        if (kv->pool[i].key == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* 
+ * kv_rehash:
+ * Doubles the hash table.
+ */                    
+void kv_rehash(kv_cache_t* kv) {
+    int* old = kv->buckets;
+    int old_n = kv->nbuckets;
+
+    kv->nbuckets = old_n ? old_n * 2 : 1024;
+    kv->buckets = malloc(sizeof(int) * kv->nbuckets);
+    if (kv->buckets == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    memset(kv->buckets, 0xff, sizeof(int) * kv->nbuckets);
+    for (int b = 0; b < old_n; b++) {
+        int i = old[b];
+        while (i >= 0) {
+            int next = kv->pool[i].hnext;
+            int nb = kv_bucket(kv, kv->pool[i].key);
+            kv->pool[i].hnext = kv->buckets[nb];
+            kv->buckets[nb] = i;
+            i = next;
+        }
+    }
+    free(old);
+}
+
+/* 
+ * kv_new:
+ * Adds an entry for key, on no list, and returns it.
+ */                    
+int kv_new(kv_cache_t* kv, unsigned long long key, unsigned int size) {
+    int i;
+
+    if (kv->count >= kv->nbuckets) {
+        kv_rehash(kv);
+    }
+    if (kv->free_head >= 0) {
+        i = kv->free_head;
+        kv->free_head = kv->pool[i].hnext;
+    } else {
+        if (kv->pool_used == kv->pool_cap) {
+            kv->pool_cap = kv->pool_cap ? kv->pool_cap * 2 : 4096;
+            kv->pool = realloc(kv->pool, sizeof(kv_entry_t) * kv->pool_cap);
+            if (kv->pool == NULL) {
+                printf("Error allocating memory");
+                exit(1);
+            }
+        }
+        i = kv->pool_used++;
+    }
+
+    kv_entry_t* e = &kv->pool[i];
+    int b = kv_bucket(kv, key);
+    memset(e, 0, sizeof(*e));
+    e->key = key;
+    e->size = size;
+    e->list = -1;
+    e->qlist = -1;
+    e->hnext = kv->buckets[b];
+    kv->buckets[b] = i;
+    kv->count++;
+    return i;
+}
+
+/* 
+ * kv_delete:
+ * Removes entry i, which must be on no list, from the hash table.
+ */                    
+void kv_delete(kv_cache_t* kv, int i) {
+    int* link = &kv->buckets[kv_bucket(kv, kv->pool[i].key)];
+
+    while (*link != i) {
+        link = &kv->pool[*link].hnext;
+    }
+    *link = kv->pool[i].hnext;
+    kv->pool[i].hnext = kv->free_head;
+    kv->free_head = i;
+    kv->count--;
+}
+
+/* 
+ * kv_push:
+ * Puts entry i at the head of list l, on its first links or, with q set,
+ * its second links.
+ */                    
+void kv_push(kv_cache_t* kv, int l, int i, int q) {
+    kv_entry_t* e = &kv->pool[i];
+    kv_list_t* list = &kv->lists[l];
+    int old = list->head;
+
+    if (q) {
+        e->qprev = -1;
+        e->qnext = old;
+        e->qlist = l;
+        if (old >= 0) {
+            kv->pool[old].qprev = i;
+        }
+    } else {
+        e->prev = -1;
+        e->next = old;
+        e->list = l;
+        if (old >= 0) {
+            kv->pool[old].prev = i;
+        }
+    }
+    list->head = i;
+    if (list->tail < 0) {
+        list->tail = i;
+    }
+    list->bytes += e->size;
+}
+
+/* 
+ * kv_unlink:
+ * Takes entry i off the list it is on (first or, with q set, second links).
+ */                    
+void kv_unlink(kv_cache_t* kv, int i, int q) {
+    kv_entry_t* e = &kv->pool[i];
+    kv_list_t* list = &kv->lists[q ? e->qlist : e->list];
+    int prev = q ? e->qprev : e->prev;
+    int next = q ? e->qnext : e->next;
+
+    if (prev >= 0) {
+        *(q ? &kv->pool[prev].qnext : &kv->pool[prev].next) = next;
+    } else {
+        list->head = next;
+    }
+    if (next >= 0) {
+        *(q ? &kv->pool[next].qprev : &kv->pool[next].prev) = prev;
+    } else {
+        list->tail = prev;
+    }
+    list->bytes -= e->size;
+    if (q) {
+        e->qlist = -1;
+    } else {
+        e->list = -1;
+    }
+}
+
+/* 
+ * kv_move:
+ * Moves entry i to the head of list l (first links).
+ */                    
+void kv_move(kv_cache_t* kv, int l, int i) {
+    kv_unlink(kv, i, 0);
+    kv_push(kv, l, i, 0);
+}
+
+/* 
+ * kv_evict:
+ * Drops the resident object i from the cache and counts the eviction.
+ * The entry itself stays (as a ghost) unless the caller deletes it.
+ */                    
+void kv_evict(kv_cache_t* kv, int i) {
+    kv->used -= kv->pool[i].size;
+    kv->evictions++;
+    kv->bytes_evicted += kv->pool[i].size;
+}
+
+/* 
+ * lru_kv_access:
+ * LRU: one recency list, evicting from its tail.
+ */                    
+int lru_kv_access(kv_cache_t* kv, int i, unsigned long long key, unsigned int size) {
+    if (i >= 0) {
+        kv_move(kv, KV_L0, i);
+    } else {
+        i = kv_new(kv, key, size);
+        kv_push(kv, KV_L0, i, 0);
+        kv->used += size;
+    }
+    while (kv->used > kv->capacity) {
+        int v = kv->lists[KV_L0].tail;
+        kv_unlink(kv, v, 0);
+        kv_evict(kv, v);
+        kv_delete(kv, v);
+    }
+    return 0;
+}
+
+/* 
+ * arc_replace:
+ * ARC's REPLACE: makes room for "need" more bytes by moving the LRU object
+ * of T1 (if T1 is above its target) or else of T2 to its ghost list.
+ */                    
+void arc_replace(kv_cache_t* kv, long long need, int hit_in_b2) {
+    while (kv->used + need > kv->capacity) {
+        long long t1 = kv->lists[KV_L0].bytes;
+        int from = KV_L1;
+
+        if (t1 > 0 && (t1 > kv->arc_p || (hit_in_b2 && t1 == kv->arc_p) ||
+                    kv->lists[KV_L1].bytes == 0)) {
+            from = KV_L0;
+        }
+        int v = kv->lists[from].tail;
+        if (v < 0) {
+            return;
+        }
+        kv_unlink(kv, v, 0);
+        kv_evict(kv, v);
+        kv_push(kv, from == KV_L0 ? KV_L2 : KV_L3, v, 0);
+    }
+}
+
+/* 
+ * arc_kv_access:
+ * ARC with sizes in bytes: T1 holds objects seen once, T2 objects seen
+ * again, and the ghost lists B1/B2 remember recent evictions from each.
+ * A ghost hit moves the target p of T1 towards the list that would have
+ * kept the object, by its size scaled with the ghost list ratio.
+ */                    
+int arc_kv_access(kv_cache_t* kv, int i, unsigned long long key, unsigned int size) {
+    kv_list_t* b1 = &kv->lists[KV_L2];
+    kv_list_t* b2 = &kv->lists[KV_L3];
+    long long c = kv->capacity;
+
+    if (i >= 0 && (kv->pool[i].list == KV_L0 || kv->pool[i].list == KV_L1)) {
+        kv_move(kv, KV_L1, i);
+        arc_replace(kv, 0, 0);
+    } else if (i >= 0) {
+        int in_b2 = kv->pool[i].list == KV_L3;
+        double ratio = in_b2 ? (double) b1->bytes / (b2->bytes ? b2->bytes : 1) :
+            (double) b2->bytes / (b1->bytes ? b1->bytes : 1);
+        long long delta = (long long) ((ratio > 1.0 ? ratio : 1.0) * size);
+
+        if (in_b2) {
+            kv->arc_p = kv->arc_p > delta ? kv->arc_p - delta : 0;
+        } else {
+            kv->arc_p = kv->arc_p + delta < c ? kv->arc_p + delta : c;
+        }
+        kv_unlink(kv, i, 0);
+        kv->pool[i].size = size;
+        arc_replace(kv, size, in_b2);
+        kv_push(kv, KV_L1, i, 0);
+        kv->used += size;
+    } else {
+        arc_replace(kv, size, 0);
+        i = kv_new(kv, key, size);
+        kv_push(kv, KV_L0, i, 0);
+        kv->used += size;
+    }
+
+    //Keep T1 + B1 within c and everything within 2c.
+    while (kv->lists[KV_L0].bytes + b1->bytes > c && b1->tail >= 0) {
+        int g = b1->tail;
+        kv_unlink(kv, g, 0);
+        kv_delete(kv, g);
+    }
+    while (kv->lists[KV_L0].bytes + kv->lists[KV_L1].bytes + b1->bytes + b2->bytes > 2 * c &&
+            b2->tail >= 0) {
+        int g = b2->tail;
+        kv_unlink(kv, g, 0);
+        kv_delete(kv, g);
+    }
+    return 0;
+}
+
+/* 
+ * lirs_prune:
+ * Removes HIR entries from the bottom of the LIRS stack, so that it always
+ * ends in a LIR entry. Ghosts that leave the stack are forgotten.
+ */                    
+void lirs_prune(kv_cache_t* kv) {
+    int t;
+
+    while ((t = kv->lists[KV_L0].tail) >= 0 && !kv->pool[t].lir) {
+        kv_unlink(kv, t, 0);
+        if (kv->pool[t].qlist == KV_L2) {
+            kv_unlink(kv, t, 1);
+            kv_delete(kv, t);
+        }
+    }
+}
+
+/* 
+ * lirs_demote:
+ * Turns the bottom LIR entry of the stack into a resident HIR entry at
+ * the end of the queue.
+ */                    
+void lirs_demote(kv_cache_t* kv) {
+    int t = kv->lists[KV_L0].tail;
+
+    kv_unlink(kv, t, 0);
+    kv->pool[t].lir = 0;
+    kv->lir_bytes -= kv->pool[t].size;
+    kv_push(kv, KV_L1, t, 1);
+    lirs_prune(kv);
+}
+
+/* 
+ * lirs_kv_access:
+ * LIRS with sizes in bytes. The LIR set (99% of the capacity) holds the
+ * objects with the shortest reuse distances; the rest is a queue of
+ * resident HIR objects, which are evicted first. The stack orders entries
+ * by recency and keeps ghosts of evicted HIR objects, so an object that
+ * comes back while still on the stack is known to have a short reuse
+ * distance and joins the LIR set.
+ */                    
+int lirs_kv_access(kv_cache_t* kv, int i, unsigned long long key, unsigned int size) {
+    long long hir_cap = kv->capacity / 100 > 0 ? kv->capacity / 100 : 1;
+    long long lir_cap = kv->capacity - hir_cap;
+    int on_stack = 0;
+
+    if (i >= 0 && kv->pool[i].lir) {
+        kv_move(kv, KV_L0, i);
+        lirs_prune(kv);
+        return 0;
+    }
+    if (i >= 0 && kv->pool[i].qlist == KV_L1) {
+        if (kv->pool[i].list == KV_L0) {
+            kv_move(kv, KV_L0, i);
+            kv_unlink(kv, i, 1);
+            kv->pool[i].lir = 1;
+            kv->lir_bytes += size;
+            while (kv->lir_bytes > lir_cap && kv->lists[KV_L0].tail != i) {
+                lirs_demote(kv);
+            }
+        } else {
+            kv_push(kv, KV_L0, i, 0);
+            kv_unlink(kv, i, 1);
+            kv_push(kv, KV_L1, i, 1);
+        }
+        return 0;
+    }
+
+    //A miss. Forget a ghost first: whether it was on the stack is all
+    //that matters, and it must not be pruned while room is made.
+    if (i >= 0) {
+        on_stack = kv->pool[i].list == KV_L0;
+        if (on_stack) {
+            kv_unlink(kv, i, 0);
+        }
+        kv_unlink(kv, i, 1);
+        kv_delete(kv, i);
+    }
+    while (kv->used + size > kv->capacity) {
+        int v = kv->lists[KV_L1].tail;
+        if (v < 0) {
+            lirs_demote(kv);
+            continue;
+        }
+        kv_unlink(kv, v, 1);
+        kv_evict(kv, v);
+        if (kv->pool[v].list == KV_L0) {
+            kv_push(kv, KV_L2, v, 1);
+        } else {
+            kv_delete(kv, v);
+        }
+    }
+
+    i = kv_new(kv, key, size);
+    kv->used += size;
+    kv_push(kv, KV_L0, i, 0);
+    if (on_stack || kv->lir_bytes + size <= lir_cap) {
+        kv->pool[i].lir = 1;
+        kv->lir_bytes += size;
+        while (kv->lir_bytes > lir_cap && kv->lists[KV_L0].tail != i) {
+            lirs_demote(kv);
+        }
+    } else {
+        kv_push(kv, KV_L1, i, 1);
+    }
+
+    //Bound the ghosts to twice the capacity.
+    while (kv->lists[KV_L2].bytes > 2 * kv->capacity) {
+        int g = kv->lists[KV_L2].tail;
+        kv_unlink(kv, g, 1);
+        kv_unlink(kv, g, 0);
+        kv_delete(kv, g);
+    }
+    return 0;
+}
+
+/* 
+ * sketch_add:
+ * Counts one access to key in the TinyLFU sketch, halving all counters
+ * every ten times as many accesses as there are objects (ageing).
+ */                    
+void sketch_add(kv_cache_t* kv, unsigned long long key) {
+    long sample = 10L * (kv->count > 1000 ? kv->count : 1000);
+
+    for (int r = 0; r < KV_SKETCH_ROWS; r++) {
+        unsigned long long h = (key + r) * 0x9E3779B97F4A7C15ULL;
+        unsigned char* ctr = &kv->sketch[(size_t) r * KV_SKETCH_WIDTH +
+            ((h ^ (h >> 29)) & (KV_SKETCH_WIDTH - 1))];
+        *ctr += *ctr < KV_SKETCH_MAX;
+    }
+    if (++kv->sketch_adds >= sample) {
+        for (size_t j = 0; j < (size_t) KV_SKETCH_ROWS * KV_SKETCH_WIDTH; j++) {
+            kv->sketch[j] >>= 1;
+        }
+        kv->sketch_adds = 0;
+    }
+}
+
+/* 
+ * sketch_freq:
+ * Returns the estimated recent access count of key.
+ */                    
+int sketch_freq(kv_cache_t* kv, unsigned long long key) {
+    int freq = KV_SKETCH_MAX;
+
+    for (int r = 0; r < KV_SKETCH_ROWS; r++) {
+        unsigned long long h = (key + r) * 0x9E3779B97F4A7C15ULL;
+        int ctr = kv->sketch[(size_t) r * KV_SKETCH_WIDTH +
+            ((h ^ (h >> 29)) & (KV_SKETCH_WIDTH - 1))];
+        if (ctr < freq) {
+            freq = ctr;
+        }
+    }
+    return freq;
+}
+
+/* 
+ * tinylfu_admit:
+ * Offers an object leaving the window to the main cache. While it does
+ * not fit, it competes with the main cache's victim (probation LRU, else
+ * protected LRU): the one with the lower sketch frequency is evicted.
+ */                    
+void tinylfu_admit(kv_cache_t* kv, int cand, long long main_cap) {
+    long long size = kv->pool[cand].size;
+
+    while (kv->lists[KV_L1].bytes + kv->lists[KV_L2].bytes + size > main_cap) {
+        int l = kv->lists[KV_L1].tail >= 0 ? KV_L1 : KV_L2;
+        int v = kv->lists[l].tail;
+
+        if (v < 0 || sketch_freq(kv, kv->pool[cand].key) <= sketch_freq(kv, kv->pool[v].key)) {
+            kv_evict(kv, cand);
+            kv_delete(kv, cand);
+            return;
+        }
+        kv_unlink(kv, v, 0);
+        kv_evict(kv, v);
+        kv_delete(kv, v);
+    }
+    kv_push(kv, KV_L1, cand, 0);
+}
+
+/* 
+ * tinylfu_kv_access:
+ * W-TinyLFU with sizes in bytes: new objects enter a small LRU window
+ * (1% of the capacity); objects leaving it are admitted to a segmented
+ * LRU main cache (probation, and protected at 80% of it) only if a
+ * count-min sketch says they are used more often than what they would
+ * displace.
+ */                    
+int tinylfu_kv_access(kv_cache_t* kv, int i, unsigned long long key, unsigned int size) {
+    long long window_cap = kv->capacity / 100 > 0 ? kv->capacity / 100 : 1;
+    long long main_cap = kv->capacity - window_cap;
+    long long protected_cap = main_cap * 8 / 10;
+
+    sketch_add(kv, key);
+    if (i >= 0 && kv->pool[i].list == KV_L0) {
+        kv_move(kv, KV_L0, i);
+    } else if (i >= 0) {
+        kv_move(kv, KV_L2, i);
+        while (kv->lists[KV_L2].bytes > protected_cap && kv->lists[KV_L2].tail != i) {
+            kv_move(kv, KV_L1, kv->lists[KV_L2].tail);
+        }
+    } else {
+        i = kv_new(kv, key, size);
+        kv_push(kv, KV_L0, i, 0);
+        kv->used += size;
+    }
+
+    while (kv->lists[KV_L0].bytes > window_cap) {
+        int cand = kv->lists[KV_L0].tail;
+        kv_unlink(kv, cand, 0);
+        tinylfu_admit(kv, cand, main_cap);
+    }
+    while (kv->used > kv->capacity) {
+        int l = kv->lists[KV_L1].tail >= 0 ? KV_L1 : KV_L2;
+        int v = kv->lists[l].tail;
+        kv_unlink(kv, v, 0);
+        kv_evict(kv, v);
+        kv_delete(kv, v);
+    }
+    return 0;
+}
+
+/* 
+ * init_kv:
+ * Sets up an empty key-value cache.
+ */                    
+void init_kv(kv_cache_t* kv, int policy, long long capacity) {
+    memset(kv, 0, sizeof(*kv));
+    kv->policy = policy;
+    kv->capacity = capacity;
+    kv->free_head = -1;
+    for (int l = 0; l < KV_LISTS; l++) {
+        kv->lists[l].head = -1;
+        kv->lists[l].tail = -1;
+    }
+    kv_rehash(kv);
+    if (policy == KV_TINYLFU) {
+        kv->sketch = calloc((size_t) KV_SKETCH_ROWS * KV_SKETCH_WIDTH, 1);
+        if (kv->sketch == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+}
+
+/* 
+ * free_kv:
+ * Frees a key-value cache.
+ */                    
+void free_kv(kv_cache_t* kv) {
+    free(kv->pool);
+    free(kv->buckets);
+    free(kv->sketch);
+    kv->pool = NULL;
+    kv->buckets = NULL;
+    kv->sketch = NULL;
+}
+
+/* 
+ * kv_resident:
+ * Returns whether entry i holds a cached object (not a ghost).
+ */                    
+int kv_resident(kv_cache_t* kv, int i) {
+    kv_entry_t* e = &kv->pool[i];
+
+    switch (kv->policy) {
+        case KV_ARC:
+            return e->list == KV_L0 || e->list == KV_L1;
+        case KV_LIRS:
+            return e->lir || e->qlist == KV_L1;
+        default:
+            return 1;
+    }
+}
+
+/* 
+ * kv_access:
+ * Simulates one request for an object. A hit on an object whose size
+ * changed is counted as a hit and then handled as a new object. Objects
+ * larger than the cache are never cached.
+ */                    
+void kv_access(kv_cache_t* kv, unsigned long long key, unsigned int size) {
+    int i = kv_find(kv, key);
+    int hit = i >= 0 && kv_resident(kv, i);
+
+    kv->requests++;
+    kv->bytes_requested += size;
+    if (hit) {
+        kv->hits++;
+        kv->bytes_hit += size;
+    } else {
+        kv->misses++;
+    }
+
+    if (hit && kv->pool[i].size != size) {
+        //Take the old version out without counting an eviction.
+        kv_entry_t* e = &kv->pool[i];
+        if (e->list >= 0) {
+            kv_unlink(kv, i, 0);
+        }
+        if (e->qlist >= 0) {
+            kv_unlink(kv, i, 1);
+        }
+        kv->used -= e->size;
+        if (e->lir) {
+            kv->lir_bytes -= e->size;
+        }
+        kv_delete(kv, i);
+        i = -1;
+        if (kv->policy == KV_LIRS) {
+            lirs_prune(kv);
+        }
+    }
+    if (size > kv->capacity) {
+        kv->bypassed++;
+        return;
+    }
+
+    switch (kv->policy) {
+        case KV_LRU:
+            lru_kv_access(kv, i, key, size);
+            break;
+        case KV_ARC:
+            arc_kv_access(kv, i, key, size);
+            break;
+        case KV_LIRS:
+            lirs_kv_access(kv, i, key, size);
+            break;
+        case KV_TINYLFU:
+            tinylfu_kv_access(kv, i, key, size);
+            break;
+    }
+}
+
+/* 
+ * parse_kv_line:
+ * Parses a "<key>,<size>" record. The key can be any text without a
+ * comma and is hashed to 64 bits. Returns 0 for blank and "#" lines.
+ */                    
+int parse_kv_line(char* buf, unsigned long long* key, unsigned int* size) {
+    char* comma = strrchr(buf, ',');
+    char* p = buf;
+
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0' || comma == NULL || comma == p) {
+        return 0;
+    }
+    *key = kv_hash(p, comma - p);
+    *size = strtoul(comma + 1, NULL, 10);
+    if (*size == 0) {
+        *size = 1;
+    }
+    return 1;
+}
+
+/* 
+ * run_kv:
+ * Replays a key-value trace against a cache of kv_capacity bytes under
+ * the given policy and reports the result.
+ * Returns the process exit status.
+ */                    
+int run_kv(char* trace_fn, int policy, long long capacity) {
+    kv_cache_t kv;
+    char buf[1000];
+    unsigned long long key;
+    unsigned int size;
+    FILE* fp = fopen(trace_fn, "r");
+
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        return 1;
+    }
+    init_kv(&kv, policy, capacity);
+    double start = now_sec();
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        if (parse_kv_line(buf, &key, &size)) {
+            kv_access(&kv, key, size);
+        }
+    }
+    double elapsed = now_sec() - start;
+    fclose(fp);
+
+    double hit_ratio = kv.requests ? (double) kv.hits / kv.requests : 0.0;
+    double byte_hit_ratio = kv.bytes_requested ? (double) kv.bytes_hit / kv.bytes_requested : 0.0;
+    if (out_format != FMT_TEXT) {
+        static result_t r;
+        r.n = 0;
+        add_field(&r, "trace", 1, "%s", trace_fn);
+        add_field(&r, "kv_policy", 1, "%s", kv_policy_names[policy]);
+        add_field(&r, "capacity", 0, "%lld", capacity);
+        add_field(&r, "requests", 0, "%ld", kv.requests);
+        add_field(&r, "hits", 0, "%ld", kv.hits);
+        add_field(&r, "misses", 0, "%ld", kv.misses);
+        add_field(&r, "evictions", 0, "%ld", kv.evictions);
+        add_field(&r, "bypassed", 0, "%ld", kv.bypassed);
+        add_field(&r, "hit_ratio", 0, "%.6f", hit_ratio);
+        add_field(&r, "byte_hit_ratio", 0, "%.6f", byte_hit_ratio);
+        add_field(&r, "seconds", 0, "%.6f", elapsed);
+        write_result(stdout, &r, out_format, 1);
+    } else {
+        print_summary(kv.hits, kv.misses, kv.evictions);
+        printf("kv: policy:%s capacity:%lld requests:%ld hit-ratio:%.4f byte-hit-ratio:%.4f "
+                "bytes-evicted:%lld bypassed:%ld\n",
+                kv_policy_names[policy], capacity, kv.requests, hit_ratio, byte_hit_ratio,
+                kv.bytes_evicted, kv.bypassed);
+    }
+    free_kv(&kv);
+    return 0;
+}
+
+
+//Type shared_trace_t: A decoded trace shared by all batch jobs that replay
+//it. The first job to need it decodes it; the last one to finish frees it.
+typedef struct shared_trace {
+    char path[256];
+    pthread_mutex_t lock;
+    int refs; //jobs that have not released the trace yet
+    int loaded;
+    trace_buf_t tb;
+} shared_trace_t;
+
+//Type batch_job_t: One (trace, configuration) pair of a batch manifest.
+typedef struct batch_job {
+    int trace; //index into batch_traces
+    cache_t cache;
+    int reuse; //collect reuse statistics
+    int line; //manifest line, reported with the result
+} batch_job_t;
+
+//Type job_deque_t: A worker's queue of job numbers. The owner pops from
+//the back, idle workers steal from the front.
+typedef struct job_deque {
+    pthread_mutex_t lock;
+    int* jobs;
+    int head;
+    int tail;
+} job_deque_t;
+
+//State of a --batch run, shared by all workers.
+batch_job_t* batch_jobs;
+int batch_njobs;
+shared_trace_t* batch_traces;
+int batch_ntraces;
+job_deque_t* batch_queues;
+int batch_nworkers = 1; //worker threads (-j)
+pthread_mutex_t batch_out_lock = PTHREAD_MUTEX_INITIALIZER;
+int batch_header = 1; //CSV header still to be written
+
+/* 
+ * decode_mapped:
+ * Decodes the trace file at path into tb, reading it through mmap() rather
+ * than stdio.
+ */                    
+void decode_mapped(const char* path, trace_buf_t* tb) {
+    struct stat st;
+    char buf[1000];
+    loader_t ld = {0};
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    char* text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+    //Copy each line out so parse_line() never reads past the mapping.
+    for (off_t pos = 0; pos < st.st_size; ) {
+        char* nl = memchr(text + pos, '\n', st.st_size - pos);
+        size_t n = (nl ? nl - (text + pos) : st.st_size - pos);
+        size_t copy = n < sizeof(buf) - 2 ? n : sizeof(buf) - 2;
+
+        memcpy(buf, text + pos, copy);
+        buf[copy] = '\n';
+        buf[copy + 1] = '\0';
+        add_line(tb, buf, &ld);
+        pos += n + 1;
+    }
+
+    munmap(text, st.st_size);
+    close(fd);
+}
+
+/* 
+ * replay_job_records:
+ * Replays data records into cache c alone (no page map, L1I or L2), with
+ * the same loop handling as replay_loop().
+ */                    
+void replay_job_records(cache_t* c, trace_rec_t* recs, size_t n, long reps) {
+    for (long it = 0; it < reps; it++) {
+        long misses = c->miss_cnt;
+        long accesses = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            char op = recs[i].op;
+            if (op == 'R') {
+                size_t body = recs[i].len < n - i - 1 ? recs[i].len : n - i - 1;
+                replay_job_records(c, &recs[i + 1], body, recs[i].addr);
+                i += body;
+            } else if (op == 'L' || op == 'S' || op == 'M') {
+                cache_access(c, recs[i].addr);
+                accesses++;
+                if (op == 'M') {
+                    cache_access(c, recs[i].addr);
+                    accesses++;
+                }
+            }
+        }
+
+        //Same steady-state argument as replay_loop().
+        if (reps > 1 && c->reuse == NULL && c->miss_cnt == misses) {
+            skip_hits(c, (reps - it - 1) * accesses);
+            return;
+        }
+    }
+}
+
+/* 
+ * run_job:
+ * Simulates one batch job and streams its result to the output.
+ */                    
+void run_job(batch_job_t* job) {
+    shared_trace_t* t = &batch_traces[job->trace];
+    static __thread result_t r;
+
+    pthread_mutex_lock(&t->lock);
+    if (!t->loaded) {
+        decode_mapped(t->path, &t->tb);
+        t->loaded = 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    if (job->reuse) {
+        job->cache.reuse = calloc(1, sizeof(reuse_stats_t));
+        if (job->cache.reuse == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+    init_cache(&job->cache);
+    double start = now_sec();
+    replay_job_records(&job->cache, t->tb.recs, t->tb.n, 1);
+    double elapsed = now_sec() - start;
+    reuse_flush(&job->cache);
+    free_cache(&job->cache);
+
+    //Drop the decoded trace once the last job using it is done.
+    pthread_mutex_lock(&t->lock);
+    if (--t->refs == 0) {
+        free_trace(&t->tb);
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    collect_cache_result(&r, t->path, &job->cache, elapsed);
+    add_field(&r, "job", 0, "%d", job->line);
+    free_duel(&job->cache);
+    pthread_mutex_lock(&batch_out_lock);
+    write_result(stdout, &r, out_format, batch_header);
+    batch_header = 0;
+    fflush(stdout);
+    pthread_mutex_unlock(&batch_out_lock);
+    free_result(&r);
+    free(job->cache.reuse);
+}
+
+/* 
+ * take_job:
+ * Returns the next job for worker w: the back of its own queue, or else
+ * the front of another worker's queue. Returns -1 when all are empty.
+ */                    
+int take_job(int w) {
+    job_deque_t* q = &batch_queues[w];
+    int job = -1;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        job = q->jobs[--q->tail];
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    for (int i = 1; job < 0 && i < batch_nworkers; i++) {
+        job_deque_t* victim = &batch_queues[(w + i) % batch_nworkers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            job = victim->jobs[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+/* 
+ * batch_worker:
+ * Thread body of a batch worker: runs jobs until no queue has any left.
+ */                    
+void* batch_worker(void* arg) {
+    int w = (int) (long) arg;
+    int job;
+
+    while ((job = take_job(w)) >= 0) {
+        run_job(&batch_jobs[job]);
+    }
+    return NULL;
+}
+
+/* 
+ * find_trace:
+ * Returns the index of the shared trace for path, adding it on first use.
+ */                    
+int find_trace(const char* path) {
+    for (int i = 0; i < batch_ntraces; i++) {
+        if (strcmp(batch_traces[i].path, path) == 0) {
+            return i;
+        }
+    }
+    shared_trace_t* t = &batch_traces[batch_ntraces];
+    memset(t, 0, sizeof(*t));
+    snprintf(t->path, sizeof(t->path), "%s", path);
+    return batch_ntraces++;
+}
+
+/* 
+ * parse_job:
+ * Parses one manifest line:
+ *   <trace> <s> <E> <b> [index=<fn>] [sets=<n>] [slices=<n>]
+ *                       [victim=<n>] [miss-cache=<n>] [policy=<name>] [reuse]
+ * Returns 0 for blank and comment ("#") lines.
+ */                    
+int parse_job(char* line, int lineno, batch_job_t* job) {
+    char* tok = strtok(line, " \t\r\n");
+    char* path = tok;
+
+    if (tok == NULL || tok[0] == '#') {
+        return 0;
+    }
+    memset(job, 0, sizeof(*job));
+    job->line = lineno;
+
+    char* geo[3];
+    for (int i = 0; i < 3; i++) {
+        geo[i] = strtok(NULL, " \t\r\n");
+        if (geo[i] == NULL) {
+            printf("manifest line %d: expected <trace> <s> <E> <b>\n", lineno);
+            exit(1);
+        }
+    }
+    job->cache.s = atoi(geo[0]);
+    job->cache.E = atoi(geo[1]);
+    job->cache.b = atoi(geo[2]);
+
+    while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+        char* val = strchr(tok, '=');
+        if (val != NULL) {
+            *val++ = '\0';
+        }
+        if (strcmp(tok, "reuse") == 0) {
+            job->reuse = 1;
+        } else if (val == NULL) {
+            printf("manifest line %d: option %s needs a value\n", lineno, tok);
+            exit(1);
+        } else if (strcmp(tok, "index") == 0) {
+            int fn;
+            for (fn = 0; fn < 4 && strcmp(val, index_names[fn]) != 0; fn++)
+                ;
+            if (fn == 4) {
+                printf("manifest line %d: unknown index function %s\n", lineno, val);
+                exit(1);
+            }
+            job->cache.index_fn = fn;
+        } else if (strcmp(tok, "policy") == 0) {
+            job->cache.policy = find_policy(val);
+            if (job->cache.policy < 0) {
+                printf("manifest line %d: unknown policy %s\n", lineno, val);
+                exit(1);
+            }
+        } else if (strcmp(tok, "sets") == 0) {
+            job->cache.slice_sets = atoi(val);
+        } else if (strcmp(tok, "slices") == 0) {
+            job->cache.slices = atoi(val);
+        } else if (strcmp(tok, "victim") == 0) {
+            job->cache.vc_kind = VC_VICTIM;
+            job->cache.vc_size = atoi(val);
+        } else if (strcmp(tok, "miss-cache") == 0) {
+            job->cache.vc_kind = VC_MISS;
+            job->cache.vc_size = atoi(val);
+        } else {
+            printf("manifest line %d: unknown option %s\n", lineno, tok);
+            exit(1);
+        }
+    }
+    if (job->cache.E < 1 || job->cache.b < 0 || job->cache.s < 0) {
+        printf("manifest line %d: invalid geometry\n", lineno);
+        exit(1);
+    }
+    check_compacted(path, job->cache.b, 0);
+    job->trace = find_trace(path);
+    batch_traces[job->trace].refs++;
+    return 1;
+}
+
+/* 
+ * run_batch:
+ * Runs every job of a manifest on batch_nworkers threads and streams one
+ * result record per job (JSON lines unless --format csv) to the output.
+ * Jobs are dealt to the workers in manifest order, in contiguous runs, so
+ * jobs on the same trace tend to share one decoded copy while it is hot;
+ * idle workers steal from the other queues.
+ * Returns the process exit status.
+ */                    
+int run_batch(char* manifest) {
+    char line[1024];
+    int lineno = 0;
+    int cap = 0;
+    FILE* fp = fopen(manifest, "r");
+
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", manifest, strerror(errno));
+        return 1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        if (batch_njobs == cap) {
+            cap = cap ? cap * 2 : 64;
+            batch_jobs = realloc(batch_jobs, sizeof(batch_job_t) * cap);
+            batch_traces = realloc(batch_traces, sizeof(shared_trace_t) * cap);
+            if (batch_jobs == NULL || batch_traces == NULL) {
+                printf("Error allocating memory");
+                exit(1);
+            }
+        }
+        //There are never more traces than jobs, so both arrays share cap.
+        batch_njobs += parse_job(line, lineno, &batch_jobs[batch_njobs]);
+    }
+    fclose(fp);
+    for (int i = 0; i < batch_ntraces; i++) {
+        pthread_mutex_init(&batch_traces[i].lock, NULL);
+    }
+
+    if (out_format == FMT_TEXT) {
+        out_format = FMT_JSON;
+    }
+    if (batch_nworkers < 1) {
+        batch_nworkers = 1;
+    }
+
+    batch_queues = calloc(batch_nworkers, sizeof(job_deque_t));
+    pthread_t* threads = malloc(sizeof(pthread_t) * batch_nworkers);
+    if (batch_queues == NULL || threads == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    for (int w = 0; w < batch_nworkers; w++) {
+        int first = (long) batch_njobs * w / batch_nworkers;
+        int last = (long) batch_njobs * (w + 1) / batch_nworkers;
+        job_deque_t* q = &batch_queues[w];
+
+        pthread_mutex_init(&q->lock, NULL);
+        q->jobs = malloc(sizeof(int) * (last - first + 1));
+        if (q->jobs == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        //The owner pops from the back, so store its run in reverse.
+        for (int j = last - 1; j >= first; j--) {
+            q->jobs[q->tail++] = j;
+        }
+    }
+
+    for (int w = 0; w < batch_nworkers; w++) {
+        pthread_create(&threads[w], NULL, batch_worker, (void*) (long) w);
+    }
+    for (int w = 0; w < batch_nworkers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    for (int w = 0; w < batch_nworkers; w++) {
+        free(batch_queues[w].jobs);
+    }
+    free(batch_queues);
+    free(threads);
+    free(batch_jobs);
+    free(batch_traces);
+    return 0;
+}
+
+
+//Type ir_header_t: Header of an IR file (--ir-cache). It is followed by
+//the per-set offsets column (S + 1 64-bit entries) and the tag column, in
+//which the tags of each set are stored contiguously in trace order, in
+//tag_bytes bytes each.
+typedef struct ir_header {
+    char magic[8]; //"CSIMIR1"
+    int b;
+    int s;
+    int tag_bytes; //4 or 8
+    int pad;
+    long long trace_size; //size and mtime of the trace it was built from
+    long long trace_mtime;
+    long long accesses;
+} ir_header_t;
+
+//Type ir_t: An IR file mapped for replay.
+typedef struct ir {
+    void* map;
+    size_t map_len;
+    ir_header_t* hdr;
+    unsigned long long* offsets;
+    unsigned char* tags;
+} ir_t;
+
+//State of a parallel IR replay, shared by the workers.
+ir_t* ir_replaying;
+int ir_next_set = 0; //next chunk of sets to hand out
+pthread_mutex_t ir_lock = PTHREAD_MUTEX_INITIALIZER;
+#define IR_CHUNK 64 //sets taken by a worker at a time
+unsigned char* ir_outcomes = NULL; //per-access outcomes for --diff-test
+
+/* 
+ * ir_supported:
+ * Returns whether the current run can be replayed from an IR: every set
+ * must be independent of the others, so nothing may share state across
+ * sets (side buffers, further levels, timing, global policy counters).
+ */                    
+int ir_supported() {
+    return cache.plain_index && !cache.use_bloom && cache.vc_kind == VC_NONE &&
+        cache.sector_bits == 0 && cache.compress_ratio == 0.0 &&
+        cache.reuse == NULL && !split_i && !use_l2 && !timing && num_regions == 0 &&
+        page_map == MAP_IDENTITY && !verbosity &&
+        (cache.policy == POLICY_LRU || cache.policy == POLICY_LIP ||
+         cache.policy == POLICY_SRRIP);
+}
+
+/* 
+ * ir_walk:
+ * Walks the data accesses of n decoded records, expanding loop records,
+ * and counts them per set (tags == NULL) or stores each tag at the next
+ * free position of its set.
+ */                    
+void ir_walk(trace_rec_t* recs, size_t n, long reps, unsigned long long* pos,
+        unsigned long long* tags) {
+    for (long it = 0; it < reps; it++) {
+        for (size_t i = 0; i < n; i++) {
+            char op = recs[i].op;
+            if (op == 'R') {
+                size_t body = recs[i].len < n - i - 1 ? recs[i].len : n - i - 1;
+                ir_walk(&recs[i + 1], body, recs[i].addr, pos, tags);
+                i += body;
+            } else if (op == 'L' || op == 'S' || op == 'M') {
+                mem_addr_t block = recs[i].addr >> cache.b;
+                int set = block & ((1ULL << cache.s) - 1);
+                for (int k = op == 'M' ? 2 : 1; k > 0; k--) {
+                    if (tags != NULL) {
+                        tags[pos[set]] = block >> cache.s;
+                    }
+                    pos[set]++;
+                }
+            }
+        }
+    }
+}
+
+/* 
+ * ir_build:
+ * Decodes trace_fn and writes its IR for the current b and s to path.
+ */                    
+void ir_build(char* trace_fn, struct stat* st, const char* path) {
+    trace_buf_t tb = {0};
+    ir_header_t hdr;
+    size_t nsets = (size_t) 1 << cache.s;
+    unsigned long long* offsets = calloc(nsets + 1, sizeof(unsigned long long));
+    unsigned long long* pos = calloc(nsets, sizeof(unsigned long long));
+
+    if (offsets == NULL || pos == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    decode_mapped(trace_fn, &tb);
+    ir_walk(tb.recs, tb.n, 1, pos, NULL);
+    for (size_t x = 0; x < nsets; x++) {
+        offsets[x + 1] = offsets[x] + pos[x];
+        pos[x] = offsets[x];
+    }
+
+    unsigned long long* tags = malloc(sizeof(unsigned long long) * (offsets[nsets] + 1));
+    if (tags == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    ir_walk(tb.recs, tb.n, 1, pos, tags);
+    free_trace(&tb);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "CSIMIR1", 8);
+    hdr.b = cache.b;
+    hdr.s = cache.s;
+    hdr.tag_bytes = 4;
+    hdr.trace_size = st->st_size;
+    hdr.trace_mtime = st->st_mtime;
+    hdr.accesses = offsets[nsets];
+    for (unsigned long long i = 0; i < offsets[nsets]; i++) {
+        if (tags[i] >> 32) {
+            hdr.tag_bytes = 8;
+            break;
+        }
+    }
+    //Narrow tags are packed in place; the array is only read forwards.
+    if (hdr.tag_bytes == 4) {
+        unsigned int* narrow = (unsigned int*) tags;
+        for (unsigned long long i = 0; i < offsets[nsets]; i++) {
+            narrow[i] = (unsigned int) tags[i];
+        }
+    }
+
+    //Write to a temporary name first, so readers never see half a file.
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp || fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            fwrite(offsets, sizeof(unsigned long long), nsets + 1, fp) != nsets + 1 ||
+            fwrite(tags, hdr.tag_bytes, offsets[nsets], fp) != offsets[nsets] ||
+            fclose(fp) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "%s: %s\n", tmp, strerror(errno));
+        exit(1);
+    }
+    free(tags);
+    free(pos);
+    free(offsets);
+}
+
+/* 
+ * ir_open:
+ * Maps the IR file at path. Returns 0 if it is missing or does not
+ * belong to the current trace, b and s.
+ */                    
+int ir_open(const char* path, struct stat* st, ir_t* ir) {
+    struct stat ist;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &ist) < 0 || ist.st_size < (off_t) sizeof(ir_header_t)) {
+        close(fd);
+        return 0;
+    }
+    ir->map_len = ist.st_size;
+    ir->map = mmap(NULL, ir->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ir->map == MAP_FAILED) {
+        return 0;
+    }
+
+    size_t nsets = (size_t) 1 << cache.s;
+    ir->hdr = ir->map;
+    ir->offsets = (unsigned long long*) (ir->hdr + 1);
+    ir->tags = (unsigned char*) (ir->offsets + nsets + 1);
+    if (memcmp(ir->hdr->magic, "CSIMIR1", 8) != 0 || ir->hdr->b != cache.b ||
+            ir->hdr->s != cache.s || ir->hdr->trace_size != st->st_size ||
+            ir->hdr->trace_mtime != st->st_mtime ||
+            sizeof(ir_header_t) + (nsets + 1) * sizeof(unsigned long long) +
+            (size_t) ir->hdr->accesses * ir->hdr->tag_bytes != ir->map_len) {
+        munmap(ir->map, ir->map_len);
+        return 0;
+    }
+    madvise(ir->map, ir->map_len, MADV_SEQUENTIAL);
+    return 1;
+}
+
+//Type set_lru_t: One set of an LRU cache in structure-of-arrays form for
+//the per-set replays (--ir-cache, --two-phase): the tag and last-use
+//columns are scanned without branches, so the compiler can vectorize them.
+typedef struct set_lru {
+    mem_addr_t* tag; //resident tags, ways 0..used-1
+    unsigned long long* stamp; //last use of each way
+    int used;
+    int E;
+    unsigned long long clock;
+} set_lru_t;
+
+/* 
+ * lru_set_access:
+ * Looks up tag in an LRU set, filling or replacing the least recently
+ * used way on a miss. Counts the outcome in c like cache_access().
+ */                    
+static inline void lru_set_access(set_lru_t* k, cache_t* c, mem_addr_t tag) {
+    int way = -1;
+
+    k->clock++;
+    for (int i = 0; i < k->used; i++) {
+        way = k->tag[i] == tag ? i : way;
+    }
+    if (way >= 0) {
+        c->hit_cnt++;
+    } else if (k->used < k->E) {
+        c->miss_cnt++;
+        way = k->used++;
+        k->tag[way] = tag;
+    } else {
+        unsigned long long oldest = k->stamp[0];
+        way = 0;
+        for (int i = 1; i < k->E; i++) {
+            way = k->stamp[i] < oldest ? i : way;
+            oldest = k->stamp[i] < oldest ? k->stamp[i] : oldest;
+        }
+        c->miss_cnt++;
+        c->evict_cnt++;
+        k->tag[way] = tag;
+    }
+    k->stamp[way] = k->clock;
+}
+
+/* 
+ * counted_outcome:
+ * Returns the ACCESS_HIT/MISS/EVICT outcome of the access just counted in
+ * c, given its miss and eviction counts from before the access.
+ */                    
+int counted_outcome(cache_t* c, long misses, long evictions) {
+    return c->miss_cnt == misses ? ACCESS_HIT :
+        c->evict_cnt == evictions ? ACCESS_MISS : ACCESS_MISS | ACCESS_EVICT;
+}
+
+/* 
+ * ir_record_set:
+ * Replays the accesses lo..hi-1 of one set like ir_worker() does, and
+ * stores the outcome of each at the same position of ir_outcomes.
+ */                    
+void ir_record_set(cache_t* c, set_lru_t* k, ir_t* ir, unsigned long long lo,
+        unsigned long long hi) {
+    k->used = 0;
+    memset(c->lines, 0, sizeof(cache_line_t) * c->E);
+    for (unsigned long long i = lo; i < hi; i++) {
+        mem_addr_t tag = ir->hdr->tag_bytes == 8 ? ((unsigned long long*) ir->tags)[i] :
+            ((unsigned int*) ir->tags)[i];
+        long misses = c->miss_cnt, evictions = c->evict_cnt;
+        if (c->policy == POLICY_LRU) {
+            lru_set_access(k, c, tag);
+        } else {
+            cache_access(c, tag);
+        }
+        ir_outcomes[i] = counted_outcome(c, misses, evictions);
+    }
+}
+
+/* 
+ * ir_worker:
+ * Thread body of an IR replay. Simulates chunks of sets, one set at a
+ * time, in a private one-set cache fed with the stored tags (with s = 0
+ * and b = 0 a tag is its own block address, so cache_access() applies
+ * unchanged). LRU sets use the set_lru_t kernel instead. Returns the
+ * worker's cache with its counters.
+ */                    
+void* ir_worker(void* arg) {
+    cache_t* c = arg;
+    ir_t* ir = ir_replaying;
+    int nsets = 1 << cache.s;
+    int wide = ir->hdr->tag_bytes == 8;
+    set_lru_t k = {0};
+
+    init_cache(c);
+    k.E = c->E;
+    k.tag = malloc(sizeof(mem_addr_t) * k.E);
+    k.stamp = malloc(sizeof(unsigned long long) * k.E);
+    if (k.tag == NULL || k.stamp == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    for (;;) {
+        pthread_mutex_lock(&ir_lock);
+        int first = ir_next_set;
+        ir_next_set += IR_CHUNK;
+        pthread_mutex_unlock(&ir_lock);
+        if (first >= nsets) {
+            break;
+        }
+
+        for (int set = first; set < first + IR_CHUNK && set < nsets; set++) {
+            unsigned long long lo = ir->offsets[set];
+            unsigned long long hi = ir->offsets[set + 1];
+
+            if (ir_outcomes != NULL) {
+                ir_record_set(c, &k, ir, lo, hi);
+                continue;
+            }
+            if (c->policy == POLICY_LRU) {
+                k.used = 0;
+                if (wide) {
+                    unsigned long long* tags = (unsigned long long*) ir->tags;
+                    for (unsigned long long i = lo; i < hi; i++) {
+                        lru_set_access(&k, c, tags[i]);
+                    }
+                } else {
+                    unsigned int* tags = (unsigned int*) ir->tags;
+                    for (unsigned long long i = lo; i < hi; i++) {
+                        lru_set_access(&k, c, tags[i]);
+                    }
+                }
+                continue;
+            }
+
+            memset(c->lines, 0, sizeof(cache_line_t) * c->E);
+            if (wide) {
+                unsigned long long* tags = (unsigned long long*) ir->tags;
+                for (unsigned long long i = lo; i < hi; i++) {
+                    cache_access(c, tags[i]);
+                }
+            } else {
+                unsigned int* tags = (unsigned int*) ir->tags;
+                for (unsigned long long i = lo; i < hi; i++) {
+                    cache_access(c, tags[i]);
+                }
+            }
+        }
+    }
+    free(k.tag);
+    free(k.stamp);
+    free_cache(c);
+    return c;
+}
+
+/* 
+ * replay_sets:
+ * Replays the per-set tag streams of ir on batch_nworkers threads (-j)
+ * and adds their counters to the global cache.
+ * Returns the replay time in seconds.
+ */                    
+double replay_sets(ir_t* ir) {
+    int workers = batch_nworkers > 0 ? batch_nworkers : 1;
+    cache_t* caches = calloc(workers, sizeof(cache_t));
+    pthread_t* threads = malloc(sizeof(pthread_t) * workers);
+    if (caches == NULL || threads == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+
+    double start = now_sec();
+    ir_replaying = ir;
+    ir_next_set = 0;
+    for (int w = 0; w < workers; w++) {
+        caches[w].E = cache.E;
+        caches[w].policy = cache.policy;
+        caches[w].backing = HUGE_OFF;
+        pthread_create(&threads[w], NULL, ir_worker, &caches[w]);
+    }
+    for (int w = 0; w < workers; w++) {
+        pthread_join(threads[w], NULL);
+        cache.hit_cnt += caches[w].hit_cnt;
+        cache.miss_cnt += caches[w].miss_cnt;
+        cache.evict_cnt += caches[w].evict_cnt;
+    }
+    double elapsed = now_sec() - start;
+
+    free(threads);
+    free(caches);
+    return elapsed;
+}
+
+/* 
+ * replay_ir:
+ * Replays trace_fn from its IR in dir, building the IR first if there is
+ * no valid one, on batch_nworkers threads (-j). The counters end up in
+ * the global cache as after a normal replay.
+ * Returns the replay time in seconds (the IR build is not included).
+ */                    
+double replay_ir(char* trace_fn, const char* dir) {
+    struct stat st;
+    char real[PATH_MAX];
+    char path[PATH_MAX + 256];
+    const char* base = strrchr(trace_fn, '/') ? strrchr(trace_fn, '/') + 1 : trace_fn;
+    ir_t ir;
+
+    if (stat(trace_fn, &st) < 0 || realpath(trace_fn, real) == NULL) {
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        exit(1);
+    }
+    mkdir(dir, 0777);
+    snprintf(path, sizeof(path), "%s/%s-%016llx-b%d-s%d.ir", dir, base,
+            kv_hash(real, strlen(real)), cache.b, cache.s);
+    if (!ir_open(path, &st, &ir)) {
+        ir_build(trace_fn, &st, path);
+        if (!ir_open(path, &st, &ir)) {
+            printf("%s: cannot read back the IR\n", path);
+            exit(1);
+        }
+        fprintf(stderr, "ir-cache: built %s\n", path);
+    }
+
+    double elapsed = replay_sets(&ir);
+    munmap(ir.map, ir.map_len);
+    return elapsed;
+}
+
+//Type part_job_t: One worker's share of the bucketing pass of --two-phase.
+typedef struct part_job {
+    trace_rec_t* recs; //top-level records, loops kept whole
+    size_t n;
+    unsigned long long* pos; //per-set counts, then next free slots
+    unsigned long long* tags; //NULL while counting
+} part_job_t;
+
+/* 
+ * part_worker:
+ * Thread body of both bucketing passes: counts the accesses of a share
+ * per set, or scatters their tags into the per-set buckets.
+ */                    
+void* part_worker(void* arg) {
+    part_job_t* job = arg;
+
+    ir_walk(job->recs, job->n, 1, job->pos, job->tags);
+    return NULL;
+}
+
+/* 
+ * run_parts:
+ * Runs part_worker() on every job in its own thread and waits for them.
+ */                    
+void run_parts(part_job_t* jobs, pthread_t* threads, int workers) {
+    for (int w = 0; w < workers; w++) {
+        pthread_create(&threads[w], NULL, part_worker, &jobs[w]);
+    }
+    for (int w = 0; w < workers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+}
+
+/* 
+ * bucket_records:
+ * The first phase of --two-phase: cuts the records of tb into one share
+ * per worker, and a radix partition on the set index buckets the tags:
+ * each worker counts its share per set, a prefix sum over (set, worker)
+ * gives every worker its own slots in each bucket, and the workers scatter
+ * into them. Buckets thus keep trace order. The result is set up in ir
+ * and hdr; the caller frees ir->offsets and ir->tags.
+ */                    
+void bucket_records(trace_buf_t* tb, int workers, ir_t* ir, ir_header_t* hdr) {
+    size_t nsets = (size_t) 1 << cache.s;
+    part_job_t* jobs = calloc(workers, sizeof(part_job_t));
+    pthread_t* threads = malloc(sizeof(pthread_t) * workers);
+    unsigned long long* offsets = calloc(nsets + 1, sizeof(unsigned long long));
+
+    if (jobs == NULL || threads == NULL || offsets == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+
+    //Cut the records into shares of about equal length, never inside a loop.
+    size_t i = 0;
+    for (int w = 0; w < workers; w++) {
+        size_t end = w == workers - 1 ? tb->n : tb->n / workers * (w + 1);
+        jobs[w].recs = tb->recs + i;
+        while (i < end) {
+            if (tb->recs[i].op == 'R') {
+                size_t body = tb->recs[i].len < tb->n - i - 1 ? tb->recs[i].len : tb->n - i - 1;
+                i += body;
+            }
+            i++;
+        }
+        jobs[w].n = tb->recs + i - jobs[w].recs;
+        jobs[w].pos = calloc(nsets, sizeof(unsigned long long));
+        if (jobs[w].pos == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+    }
+
+    run_parts(jobs, threads, workers);
+    for (size_t x = 0; x < nsets; x++) {
+        offsets[x + 1] = offsets[x];
+        for (int w = 0; w < workers; w++) {
+            unsigned long long count = jobs[w].pos[x];
+            jobs[w].pos[x] = offsets[x + 1];
+            offsets[x + 1] += count;
+        }
+    }
+    unsigned long long* tags = malloc(sizeof(unsigned long long) * (offsets[nsets] + 1));
+    if (tags == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    for (int w = 0; w < workers; w++) {
+        jobs[w].tags = tags;
+    }
+    run_parts(jobs, threads, workers);
+
+    hdr->tag_bytes = 8;
+    hdr->accesses = offsets[nsets];
+    ir->hdr = hdr;
+    ir->offsets = offsets;
+    ir->tags = (unsigned char*) tags;
+    for (int w = 0; w < workers; w++) {
+        free(jobs[w].pos);
+    }
+    free(threads);
+    free(jobs);
+}
+
+/* 
+ * replay_two_phase:
+ * Replays trace_fn in two parallel phases (--two-phase): the decoded
+ * trace is bucketed by set on -j workers by bucket_records(), and the
+ * sets are then replayed independently by replay_sets().
+ * Returns the time of both phases in seconds.
+ */                    
+double replay_two_phase(char* trace_fn) {
+    trace_buf_t tb = {0};
+    int workers = batch_nworkers > 0 ? batch_nworkers : 1;
+    ir_header_t hdr = {0};
+    ir_t ir = {0};
+
+    decode_mapped(trace_fn, &tb);
+    double start = now_sec();
+    bucket_records(&tb, workers, &ir, &hdr);
+    double bucket = now_sec() - start;
+    free_trace(&tb);
+
+    double simulate = replay_sets(&ir);
+    fprintf(stderr, "two-phase: %d workers, bucket %.3fs, simulate %.3fs\n",
+            workers, bucket, simulate);
+    free(ir.tags);
+    free(ir.offsets);
+    return bucket + simulate;
+}
+
+
+//Globals of the multi-core mode (--cores): one private L1 (-s, -E, -b)
+//and optional L2 (--l2) per core, in front of a shared LLC (--llc).
+#define MAX_CORES 64
+cache_t l1_geometry; //s, E, b of each private L1
+cache_t llc_geometry; //s, E, b of the LLC
+long llc_hint_demotions = 0; //LLC lines demoted by a dead clean eviction
+long llc_hint_promotions = 0; //LLC lines promoted by a reuse hint
+long llc_clean_notices = 0; //clean evictions reported by the cores
+long mem_writebacks = 0; //dirty blocks written back to memory
+
+//Type core_t: One core of the multi-core mode and its trace cursor. Loop
+//records are replayed in place, without expanding them.
+typedef struct core {
+    char* trace;
+    trace_buf_t tb;
+    size_t pos; //next record
+    size_t loop_start, loop_end; //body of the current loop, if any
+    long loop_left; //iterations of the body still to replay
+    int second; //the store half of an "M" is next
+    cache_t l1, l2;
+    long llc_hits, llc_misses;
+} core_t;
+
+/* 
+ * cache_find:
+ * Returns the line of cache c holding addr's block, or NULL. Does not
+ * count as an access.
+ */                    
+cache_line_t* cache_find(cache_t* c, mem_addr_t addr) {
+    mem_addr_t block = addr >> c->b;
+    int set = c->plain_index ? (int) (block & ((1ULL << c->s) - 1)) : cache_index(c, block);
+    mem_addr_t tag = c->plain_index ? block >> c->s : block;
+    cache_set_t lines = c->lines + (size_t) set * c->E;
+
+    for (int i = 0; i < c->E; i++) {
+        if (lines[i].valid && lines[i].tag == tag) {
+            return &lines[i];
+        }
+    }
+    return NULL;
+}
+
+/* 
+ * llc_hint:
+ * Delivers the eviction of a block from a core's last private level to
+ * the LLC. A dirty block is written back. With hints, a block that was
+ * reused in the private levels is promoted to MRU (a reuse hint), and a
+ * clean block reused neither there nor in the LLC is demoted to LRU (a
+ * clean-eviction notice of a probably dead block). Without hints clean
+ * evictions are silent, as in a plain non-inclusive hierarchy.
+ */                    
+void llc_hint(cache_t* llc, mem_addr_t addr, int hits, int dirty, int hints) {
+    cache_line_t* line = cache_find(llc, addr);
+
+    if (dirty) {
+        if (line != NULL) {
+            line->dirty = 1;
+        } else {
+            mem_writebacks++;
+        }
+    } else if (hints) {
+        llc_clean_notices++;
+    }
+    if (!hints || line == NULL) {
+        return;
+    }
+    if (hits > 0) {
+        line->lru_counter = 0;
+        line->rrpv = 0;
+        llc_hint_promotions++;
+    } else if (!dirty && line->hit_count == 0) {
+        cache_set_t set = llc->lines + (line - llc->lines) / llc->E * llc->E;
+        int oldest = 0;
+        for (int i = 0; i < llc->E; i++) {
+            if (set[i].valid && set[i].lru_counter > oldest) {
+                oldest = set[i].lru_counter;
+            }
+        }
+        line->lru_counter = oldest + 1;
+        line->rrpv = RRPV_MAX;
+        llc_hint_demotions++;
+    }
+}
+
+/* 
+ * core_access:
+ * Simulates one access of a core: L1, then the L2 if there is one, then
+ * the shared LLC, filling every level on the way back (non-inclusive: LLC
+ * evictions do not invalidate private copies). A dirty or reused L1
+ * victim updates its L2 copy; victims that leave the core go to
+ * llc_hint().
+ */                    
+void core_access(core_t* core, cache_t* llc, mem_addr_t addr, int store, int hints) {
+    cache_t* last = use_l2 ? &core->l2 : &core->l1;
+    int result;
+
+    core->l1.store = store;
+    result = cache_access(&core->l1, addr);
+    if ((result & ACCESS_EVICT) && use_l2) {
+        cache_t* l1 = &core->l1;
+        cache_line_t* copy = cache_find(&core->l2, l1->victim_block << l1->b);
+        if (copy != NULL) {
+            copy->dirty |= l1->victim_dirty;
+            copy->hit_count += l1->victim_hits;
+        } else {
+            llc_hint(llc, l1->victim_block << l1->b, l1->victim_hits, l1->victim_dirty, hints);
+        }
+    }
+    if (use_l2 && !(result & ACCESS_HIT)) {
+        result = cache_access(&core->l2, addr);
+    }
+    if (result & ACCESS_EVICT) {
+        llc_hint(llc, last->victim_block << last->b, last->victim_hits,
+                last->victim_dirty, hints);
+    }
+    if (result & ACCESS_HIT) {
+        return;
+    }
+
+    result = cache_access(llc, addr);
+    if (result & ACCESS_HIT) {
+        core->llc_hits++;
+    } else {
+        core->llc_misses++;
+    }
+    if ((result & ACCESS_EVICT) && llc->victim_dirty) {
+        mem_writebacks++;
+    }
+}
+
+/* 
+ * core_next:
+ * Fetches the next data access of a core. Returns 0 at the end of its
+ * trace, else 1 with the address and whether it is a store.
+ */                    
+int core_next(core_t* core, mem_addr_t* addr, int* store) {
+    for (;;) {
+        if (core->loop_left > 0 && core->pos == core->loop_end) {
+            if (--core->loop_left > 0) {
+                core->pos = core->loop_start;
+            }
+        }
+        if (core->pos >= core->tb.n) {
+            return 0;
+        }
+
+        trace_rec_t* rec = &core->tb.recs[core->pos];
+        if (rec->op == 'R' && core->loop_left == 0) {
+            size_t body = rec->len < core->tb.n - core->pos - 1 ? rec->len : core->tb.n - core->pos - 1;
+            core->loop_start = core->pos + 1;
+            core->loop_end = core->loop_start + body;
+            core->loop_left = rec->addr;
+            core->pos = core->loop_start;
+            continue;
+        }
+        if (rec->op == 'M' && !core->second) {
+            core->second = 1;
+            *addr = rec->addr;
+            *store = 0;
+            return 1;
+        }
+        core->second = 0;
+        core->pos++;
+        if (rec->op == 'L' || rec->op == 'S' || rec->op == 'M') {
+            *addr = rec->addr;
+            *store = rec->op != 'L';
+            return 1;
+        }
+    }
+}
+
+/* 
+ * run_cores_once:
+ * Co-runs the traces of all cores, one access per core in turn, from
+ * cold caches. Fills in the LLC statistics for one hint setting.
+ */                    
+void run_cores_once(core_t* cores, int ncores, cache_t* llc, int hints) {
+    int active = ncores;
+
+    llc_hint_demotions = 0;
+    llc_hint_promotions = 0;
+    llc_clean_notices = 0;
+    mem_writebacks = 0;
+    *llc = llc_geometry;
+    llc->policy = cache.policy;
+    init_cache(llc);
+    for (int i = 0; i < ncores; i++) {
+        core_t* core = &cores[i];
+        core->l1 = l1_geometry;
+        init_cache(&core->l1);
+        if (use_l2) {
+            core->l2 = l2cache;
+            init_cache(&core->l2);
+        }
+        core->pos = 0;
+        core->loop_left = 0;
+        core->second = 0;
+        core->llc_hits = 0;
+        core->llc_misses = 0;
+    }
+
+    while (active > 0) {
+        active = 0;
+        for (int i = 0; i < ncores; i++) {
+            mem_addr_t addr;
+            int store;
+            if (core_next(&cores[i], &addr, &store)) {
+                core_access(&cores[i], llc, addr, store, hints);
+                active++;
+            }
+        }
+    }
+}
+
+/* 
+ * run_cores:
+ * Multi-core mode (--cores): co-runs a comma-separated list of traces on
+ * private caches in front of a shared non-inclusive LLC, once without and
+ * once with replacement hints, and reports how the hints change the LLC
+ * miss ratio. Returns the process exit status.
+ */                    
+int run_cores(char* trace_list) {
+    core_t* cores = calloc(MAX_CORES, sizeof(core_t));
+    long misses[2], accesses[2];
+    long demotions = 0, promotions = 0, notices = 0, writebacks[2];
+    int ncores = 0;
+    cache_t llc;
+
+    if (cores == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+    for (char* t = strtok(trace_list, ","); t != NULL; t = strtok(NULL, ",")) {
+        if (ncores == MAX_CORES) {
+            printf("--cores: at most %d traces\n", MAX_CORES);
+            exit(1);
+        }
+        check_compacted(t, l1_geometry.b, 0);
+        check_compacted(t, llc_geometry.b, 0);
+        if (use_l2) {
+            check_compacted(t, l2cache.b, 0);
+        }
+        cores[ncores].trace = t;
+        decode_mapped(t, &cores[ncores].tb);
+        ncores++;
+    }
+
+    if (out_format == FMT_TEXT) {
+        printf("cores:%d L1:%d,%d,%d", ncores, l1_geometry.s, l1_geometry.E, l1_geometry.b);
+        if (use_l2) {
+            printf(" L2:%d,%d,%d", l2cache.s, l2cache.E, l2cache.b);
+        }
+        printf(" LLC:%d,%d,%d policy:%s\n", llc_geometry.s, llc_geometry.E,
+                llc_geometry.b, policy_names[cache.policy]);
+    }
+    double start = now_sec();
+    for (int hints = 0; hints < 2; hints++) {
+        run_cores_once(cores, ncores, &llc, hints);
+        accesses[hints] = llc.hit_cnt + llc.miss_cnt;
+        misses[hints] = llc.miss_cnt;
+        writebacks[hints] = mem_writebacks;
+        if (hints) {
+            demotions = llc_hint_demotions;
+            promotions = llc_hint_promotions;
+            notices = llc_clean_notices;
+        }
+        for (int i = 0; i < ncores && out_format == FMT_TEXT; i++) {
+            core_t* core = &cores[i];
+            printf("hints:%s core:%d trace:%s L1 hits:%ld misses:%ld", hints ? "on" : "off",
+                    i, core->trace, core->l1.hit_cnt, core->l1.miss_cnt);
+            if (use_l2) {
+                printf(" L2 hits:%ld misses:%ld", core->l2.hit_cnt, core->l2.miss_cnt);
+            }
+            printf(" LLC hits:%ld misses:%ld\n", core->llc_hits, core->llc_misses);
+        }
+        for (int i = 0; i < ncores; i++) {
+            free_cache(&cores[i].l1);
+            if (use_l2) {
+                free_cache(&cores[i].l2);
+            }
+        }
+        free_cache(&llc);
+        free_duel(&llc);
+    }
+    double elapsed = now_sec() - start;
+
+    double ratio[2];
+    for (int hints = 0; hints < 2; hints++) {
+        ratio[hints] = accesses[hints] ? (double) misses[hints] / accesses[hints] : 0.0;
+    }
+    if (out_format != FMT_TEXT) {
+        static result_t r;
+        r.n = 0;
+        add_field(&r, "cores", 0, "%d", ncores);
+        add_field(&r, "llc_s", 0, "%d", llc_geometry.s);
+        add_field(&r, "llc_E", 0, "%d", llc_geometry.E);
+        add_field(&r, "llc_b", 0, "%d", llc_geometry.b);
+        add_field(&r, "policy", 1, "%s", policy_names[cache.policy]);
+        add_field(&r, "llc_accesses", 0, "%ld", accesses[0]);
+        add_field(&r, "llc_misses", 0, "%ld", misses[0]);
+        add_field(&r, "llc_misses_hinted", 0, "%ld", misses[1]);
+        add_field(&r, "llc_miss_ratio", 0, "%.6f", ratio[0]);
+        add_field(&r, "llc_miss_ratio_hinted", 0, "%.6f", ratio[1]);
+        add_field(&r, "clean_notices", 0, "%ld", notices);
+        add_field(&r, "demotions", 0, "%ld", demotions);
+        add_field(&r, "promotions", 0, "%ld", promotions);
+        add_field(&r, "mem_writebacks", 0, "%ld", writebacks[0]);
+        add_field(&r, "mem_writebacks_hinted", 0, "%ld", writebacks[1]);
+        add_field(&r, "seconds", 0, "%.6f", elapsed);
+        write_result(stdout, &r, out_format, 1);
+    } else {
+        printf("LLC hints:off accesses:%ld misses:%ld miss-ratio:%.4f mem-writebacks:%ld\n",
+                accesses[0], misses[0], ratio[0], writebacks[0]);
+        printf("LLC hints:on accesses:%ld misses:%ld miss-ratio:%.4f mem-writebacks:%ld "
+                "clean-notices:%ld demotions:%ld promotions:%ld\n",
+                accesses[1], misses[1], ratio[1], writebacks[1], notices, demotions, promotions);
+        printf("LLC misses with hints: %+.2f%%\n",
+                misses[0] ? 100.0 * (misses[1] - misses[0]) / misses[0] : 0.0);
+    }
+
+    for (int i = 0; i < ncores; i++) {
+        free_trace(&cores[i].tb);
+    }
+    free(cores);
+    return 0;
+}
+
+//Outcome bits compared by the differential test.
+#define DIFF_FLAGS (ACCESS_HIT | ACCESS_MISS | ACCESS_EVICT)
+
+/* 
+ * outcome_name:
+ * Returns a name for the DIFF_FLAGS bits of an access outcome.
+ */                    
+const char* outcome_name(int result) {
+    result &= DIFF_FLAGS;
+    return result == ACCESS_HIT ? "hit" : result == ACCESS_MISS ? "miss" :
+        result == (ACCESS_MISS | ACCESS_EVICT) ? "miss+evict" : "invalid";
+}
+
+/* 
+ * expand_records:
+ * Appends the data accesses of n records to out, one 'L' record each,
+ * with loop records expanded and "M" split into its two accesses.
+ */                    
+void expand_records(trace_rec_t* recs, size_t n, long reps, trace_buf_t* out) {
+    for (long it = 0; it < reps; it++) {
+        for (size_t i = 0; i < n; i++) {
+            char op = recs[i].op;
+            if (op == 'R') {
+                size_t body = recs[i].len < n - i - 1 ? recs[i].len : n - i - 1;
+                expand_records(&recs[i + 1], body, recs[i].addr, out);
+                i += body;
+            } else if (op == 'L' || op == 'S' || op == 'M') {
+                push_rec(out, 'L', recs[i].addr, recs[i].len);
+                if (op == 'M') {
+                    push_rec(out, 'L', recs[i].addr, recs[i].len);
+                }
+            }
+        }
+    }
+}
+
+/* 
+ * diff_setup:
+ * Gives c the geometry and policy of the global cache and initializes it.
+ */                    
+void diff_setup(cache_t* c, int use_bloom) {
+    memset(c, 0, sizeof(cache_t));
+    c->s = cache.s;
+    c->E = cache.E;
+    c->b = cache.b;
+    c->index_fn = cache.index_fn;
+    c->policy = cache.policy;
+    c->use_bloom = use_bloom;
+    init_cache(c);
+}
+
+/* 
+ * diff_levels:
+ * Initializes (init set) or frees the global cache and the L2 behind it.
+ */                    
+void diff_levels(int init) {
+    if (init) {
+        init_cache(&cache);
+        if (use_l2) {
+            init_cache(&l2cache);
+        }
+    } else {
+        free_cache(&cache);
+        free_duel(&cache);
+        if (use_l2) {
+            free_cache(&l2cache);
+        }
+    }
+}
+
+//Counters besides the L1 outcomes that loop skipping must keep exact.
+#define DIFF_EXTRAS 6
+const char* diff_extra_names[DIFF_EXTRAS] = {"victim-hits", "sector-misses",
+    "space-evictions", "l2-hits", "epochs-a", "epochs-b"};
+
+/* 
+ * diff_extras:
+ * Reads the DIFF_EXTRAS counters of the global cache and L2 into x.
+ */                    
+void diff_extras(long* x) {
+    x[0] = cache.vc_hit_cnt;
+    x[1] = cache.sector_miss_cnt;
+    x[2] = cache.space_evict_cnt;
+    x[3] = use_l2 ? l2cache.hit_cnt : 0;
+    x[4] = cache.duel != NULL ? cache.duel->epochs_won[0] : 0;
+    x[5] = cache.duel != NULL ? cache.duel->epochs_won[1] : 0;
+}
+
+/* 
+ * diff_run:
+ * Runs trace tb through the reference oracle, access_data() on the global
+ * cache (configured by the caller), and through every alternative engine
+ * that supports the configuration:
+ *   bloom      bloom_access() (--bloom)
+ *   soa        the set_lru_t kernel of the per-set replays
+ *   per-set    replay_sets() on two threads over the trace bucketed by set
+ *   two-phase  the same over the buckets of bucket_records() on 3 workers
+ *   loops      replay_buffer(), which skips steady-state loop iterations
+ * All but the last are compared access by access. Skipped iterations have
+ * no outcomes of their own, so "loops" is compared record by record, on
+ * the counts over all accesses of a record (of a whole loop for "R"), and
+ * on the DIFF_EXTRAS counters at the end.
+ * Returns 0 if all engines agree, else 1 with the first divergence in msg.
+ */                    
+int diff_run(trace_buf_t* tb, char* msg, size_t msg_len) {
+    trace_buf_t flat = {0};
+    int plain = cache.policy == POLICY_LRU && cache.sector_bits == 0 &&
+        cache.compress_ratio == 0.0;
+    int failed = 0;
+
+    expand_records(tb->recs, tb->n, 1, &flat);
+    unsigned char* oracle = malloc(flat.n + 1);
+    //Evictions before each access: a compressed fill can evict several lines.
+    long* evicted = malloc(sizeof(long) * (flat.n + 1));
+    if (oracle == NULL || evicted == NULL) {
+        printf("Error allocating memory");
+        exit(1);
+    }
+
+    diff_levels(1);
+    for (size_t k = 0; k < flat.n; k++) {
+        evicted[k] = cache.evict_cnt;
+        oracle[k] = access_data(flat.recs[k].addr) & DIFF_FLAGS;
+    }
+    evicted[flat.n] = cache.evict_cnt;
+    long want_extras[DIFF_EXTRAS], got_extras[DIFF_EXTRAS];
+    diff_extras(want_extras);
+    int ir_ok = ir_supported();
+    diff_levels(0);
+
+    //LRU engines that see the accesses one at a time.
+    for (int engine = 0; engine < 2 && plain && !failed; engine++) {
+        cache_t c;
+        set_lru_t* sets = NULL;
+        diff_setup(&c, engine == 0);
+        if (engine == 1) {
+            sets = calloc(c.S, sizeof(set_lru_t));
+            for (int x = 0; x < c.S && sets != NULL; x++) {
+                sets[x].E = c.E;
+                sets[x].tag = malloc(sizeof(mem_addr_t) * c.E);
+                sets[x].stamp = malloc(sizeof(unsigned long long) * c.E);
+                if (sets[x].tag == NULL || sets[x].stamp == NULL) {
+                    printf("Error allocating memory");
+                    exit(1);
+                }
+            }
+            if (sets == NULL) {
+                printf("Error allocating memory");
+                exit(1);
+            }
+        }
+
+        for (size_t k = 0; k < flat.n; k++) {
+            mem_addr_t addr = flat.recs[k].addr;
+            int result;
+            if (engine == 0) {
+                result = cache_access(&c, addr) & DIFF_FLAGS;
+            } else {
+                mem_addr_t block = addr >> c.b;
+                int set = c.plain_index ? (int) (block & ((1ULL << c.s) - 1)) : cache_index(&c, block);
+                long misses = c.miss_cnt, evictions = c.evict_cnt;
+                lru_set_access(&sets[set], &c, c.plain_index ? block >> c.s : block);
+                result = counted_outcome(&c, misses, evictions);
+            }
+            if (result != oracle[k]) {
+                snprintf(msg, msg_len, "%s engine: access %zu (address %llx) is a %s, "
+                        "the oracle has a %s", engine == 0 ? "bloom" : "soa", k, addr,
+                        outcome_name(result), outcome_name(oracle[k]));
+                failed = 1;
+                break;
+            }
+        }
+
+        if (sets != NULL) {
+            for (int x = 0; x < c.S; x++) {
+                free(sets[x].tag);
+                free(sets[x].stamp);
+            }
+            free(sets);
+        }
+        free_cache(&c);
+    }
+
+    //Engines that replay each set on its own, from buckets in trace order.
+    for (int engine = 0; engine < 2 && ir_ok && !failed; engine++) {
+        size_t nsets = (size_t) 1 << cache.s;
+        unsigned long long* pos = calloc(nsets, sizeof(unsigned long long));
+        ir_header_t hdr = {0};
+        ir_t ir = {0};
+        int workers = batch_nworkers;
+
+        if (pos == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        if (engine == 0) {
+            unsigned long long* offsets = calloc(nsets + 1, sizeof(unsigned long long));
+            unsigned long long* tags = malloc(sizeof(unsigned long long) * (flat.n + 1));
+            if (offsets == NULL || tags == NULL) {
+                printf("Error allocating memory");
+                exit(1);
+            }
+            ir_walk(tb->recs, tb->n, 1, pos, NULL);
+            for (size_t x = 0; x < nsets; x++) {
+                offsets[x + 1] = offsets[x] + pos[x];
+                pos[x] = offsets[x];
+            }
+            ir_walk(tb->recs, tb->n, 1, pos, tags);
+            hdr.tag_bytes = 8;
+            hdr.accesses = offsets[nsets];
+            ir.hdr = &hdr;
+            ir.offsets = offsets;
+            ir.tags = (unsigned char*) tags;
+        } else {
+            bucket_records(tb, 3, &ir, &hdr);
+        }
+
+        ir_outcomes = malloc(hdr.accesses + 1);
+        if (ir_outcomes == NULL) {
+            printf("Error allocating memory");
+            exit(1);
+        }
+        init_cache(&cache);
+        batch_nworkers = 2;
+        replay_sets(&ir);
+        batch_nworkers = workers;
+        free_cache(&cache);
+        free_duel(&cache);
+
+        //The k-th access of a set in trace order is at offsets[set] + k.
+        memcpy(pos, ir.offsets, sizeof(unsigned long long) * nsets);
+        for (size_t k = 0; k < flat.n; k++) {
+            mem_addr_t addr = flat.recs[k].addr;
+            int result = ir_outcomes[pos[(addr >> cache.b) & (nsets - 1)]++];
+            if (result != oracle[k]) {
+                snprintf(msg, msg_len, "%s engine: access %zu (address %llx) is a %s, "
+                        "the oracle has a %s", engine == 0 ? "per-set" : "two-phase", k,
+                        addr, outcome_name(result), outcome_name(oracle[k]));
+                failed = 1;
+                break;
+            }
+        }
+        free(ir_outcomes);
+        ir_outcomes = NULL;
+        free(ir.tags);
+        free(ir.offsets);
+        free(pos);
+    }
+
+    //Loop skipping, compared on the counts of every record.
+    diff_levels(1);
+    for (size_t i = 0, k = 0; i < tb->n && !failed; i++) {
+        long before[3] = {cache.hit_cnt, cache.miss_cnt, cache.evict_cnt};
+        long want[3] = {0, 0, 0};
+        size_t first = k;
+        int loop = tb->recs[i].op == 'R';
+
+        if (loop) {
+            size_t body = tb->recs[i].len < tb->n - i - 1 ? tb->recs[i].len : tb->n - i - 1;
+            trace_buf_t iter = {0};
+            expand_records(&tb->recs[i + 1], body, tb->recs[i].addr, &iter);
+            replay_loop(&tb->recs[i + 1], body, tb->recs[i].addr);
+            k += iter.n;
+            free_trace(&iter);
+            i += body;
+        } else {
+            replay_record(tb->recs[i].op, tb->recs[i].addr, tb->recs[i].len);
+            k += tb->recs[i].op == 'M' ? 2 : 1;
+        }
+        for (size_t j = first; j < k; j++) {
+            want[0] += oracle[j] == ACCESS_HIT;
+            want[1] += oracle[j] != ACCESS_HIT;
+        }
+        want[2] = evicted[k] - evicted[first];
+        if (cache.hit_cnt - before[0] != want[0] || cache.miss_cnt - before[1] != want[1] ||
+                cache.evict_cnt - before[2] != want[2]) {
+            snprintf(msg, msg_len, "loops engine: %s at accesses %zu-%zu has hits:%ld "
+                    "misses:%ld evictions:%ld, the oracle has hits:%ld misses:%ld evictions:%ld",
+                    loop ? "loop record" : "record", first, k - 1,
+                    cache.hit_cnt - before[0], cache.miss_cnt - before[1],
+                    cache.evict_cnt - before[2], want[0], want[1], want[2]);
+            failed = 1;
+        }
+    }
+    diff_extras(got_extras);
+    for (int x = 0; x < DIFF_EXTRAS && !failed; x++) {
+        if (got_extras[x] != want_extras[x]) {
+            snprintf(msg, msg_len, "loops engine: %s:%ld, the oracle has %s:%ld",
+                    diff_extra_names[x], got_extras[x], diff_extra_names[x], want_extras[x]);
+            failed = 1;
+        }
+    }
+    diff_levels(0);
+
+    free(evicted);
+    free(oracle);
+    free_trace(&flat);
+    return failed;
+}
+
+/* 
+ * diff_config:
+ * Prints the configuration of the global cache as csim options.
+ */                    
+void diff_config(FILE* fp) {
+    fprintf(fp, "-s %d -E %d -b %d --policy %s --index %s", cache.s,
+            cache.compress_ratio > 0.0 ? cache.data_ways : cache.E, cache.b,
+            policy_names[cache.policy], index_names[cache.index_fn]);
+    if (cache.vc_kind != VC_NONE) {
+        fprintf(fp, " --%s %d", cache.vc_kind == VC_VICTIM ? "victim" : "miss-cache",
+                cache.vc_size);
+    }
+    if (cache.policy == POLICY_DIP || cache.policy == POLICY_DRRIP) {
+        fprintf(fp, " --duel-epoch %ld", cache.duel_epoch);
+    }
+    if (use_l2) {
+        fprintf(fp, " --l2 %d,%d,%d", l2cache.s, l2cache.E, l2cache.b);
+    }
+    if (cache.sector_bits > 0) {
+        fprintf(fp, " --sectors %d", 1 << cache.sector_bits);
+    }
+    if (cache.compress_ratio > 0.0) {
+        fprintf(fp, " --compress %g", cache.compress_ratio);
+    }
+}
+
+/* 
+ * diff_test:
+ * Differential test of the alternative engines against access_data()
+ * (--diff-test): random geometries, policies (dueling ones included) and
+ * index functions, some with a side buffer, an L2, sectors or compression,
+ * each with a random trace of loads, stores, modifies and loop records
+ * over a footprint around the cache size. Prints the first divergence.
+ * Returns the process exit status.
+ */                    
+int diff_test(long iterations) {
+    static const int ways[] = {1, 2, 3, 4, 5, 8, 16, 64};
+    char msg[300];
+
+    rng_state = gen_seed ? gen_seed : 1;
+    for (long it = 0; it < iterations; it++) {
+        trace_buf_t tb = {0};
+
+        memset(&cache, 0, sizeof(cache));
+        cache.s = rand64() % 7;
+        cache.E = ways[rand64() % (sizeof(ways) / sizeof(ways[0]))];
+        cache.b = 1 + rand64() % 6;
+        cache.policy = rand64() % NUM_POLICIES;
+        cache.index_fn = rand64() % 4 == 0 ? INDEX_XOR : INDEX_MASK;
+        //Short epochs, so that skipped loop iterations cross their ends.
+        cache.duel_epoch = 1 + rand64() % 200;
+
+        mem_addr_t footprint = ((mem_addr_t) cache.E << (cache.s + cache.b)) *
+            (1 + rand64() % 4) / (1 + rand64() % 2);
+
+        //Options around the L1 that only some of the engines support.
+        use_l2 = 0;
+        if (rand64() % 4 == 0) {
+            cache.vc_kind = rand64() % 2 ? VC_VICTIM : VC_MISS;
+            cache.vc_size = 1 + rand64() % 8;
+        }
+        if (rand64() % 4 == 0) {
+            memset(&l2cache, 0, sizeof(l2cache));
+            l2cache.s = cache.s + 1;
+            l2cache.E = 2 * cache.E;
+            l2cache.b = cache.b;
+            use_l2 = 1;
+        }
+        if (rand64() % 4 == 0) {
+            cache.sector_bits = 1 + rand64() % cache.b;
+        }
+        if (rand64() % 4 == 0) {
+            cache.compress_ratio = 1 + rand64() % 3;
+            cache.data_ways = cache.E;
+            cache.E *= COMPRESS_TAGS;
+        }
+        int n = 100 + rand64() % 4000;
+        for (int i = 0; i < n; i++) {
+            if (rand64() % 40 == 0) {
+                //A loop over a short body, which is generated next.
+                unsigned int body = 1 + rand64() % 8;
+                push_rec(&tb, 'R', 1 + rand64() % 30, body);
+                for (unsigned int j = 0; j < body; j++) {
+                    push_rec(&tb, "LSM"[rand64() % 3], rand64() % footprint, 4);
+                }
+                i += body;
+            } else {
+                push_rec(&tb, "LSM"[rand64() % 3], rand64() % footprint, 4);
+            }
+        }
+
+        if (diff_run(&tb, msg, sizeof(msg))) {
+            printf("diff-test: iteration %ld (", it);
+            diff_config(stdout);
+            printf("): %s\n", msg);
+            free_trace(&tb);
+            return 1;
+        }
+        free_trace(&tb);
+    }
+    use_l2 = 0;
+    printf("diff-test: %ld configurations, all engines agree with access_data()\n",
+            iterations);
+    return 0;
+}
+
+#ifdef CSIM_FUZZ
+/* 
+ * LLVMFuzzerTestOneInput:
+ * libFuzzer entry point for the differential test: the first 4 bytes
+ * pick s, E, b and the policy, then every 3 bytes are one record (op and
+ * a 16-bit address; op 3 starts a loop outside loops). Divergences abort.
+ * Build: clang -g -O1 -fsanitize=fuzzer,address -DCSIM_FUZZ csim.c -lm
+ */                    
+int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size) {
+    trace_buf_t tb = {0};
+    unsigned int loop_left = 0;
+    char msg[300];
+
+    if (size < 4) {
+        return 0;
+    }
+    memset(&cache, 0, sizeof(cache));
+    cache.s = data[0] % 7;
+    cache.E = 1 + data[1] % 16;
+    cache.b = 1 + data[2] % 6;
+    cache.policy = data[3] % NUM_POLICIES;
+    cache.index_fn = data[3] / NUM_POLICIES % 2 ? INDEX_XOR : INDEX_MASK;
+    for (size_t i = 4; i + 3 <= size; i += 3) {
+        mem_addr_t addr = data[i + 1] | data[i + 2] << 8;
+        if (data[i] % 4 == 3 && loop_left == 0) {
+            loop_left = 1 + data[i + 2] % 8;
+            push_rec(&tb, 'R', 1 + data[i + 1] % 16, loop_left);
+        } else {
+            push_rec(&tb, "LSML"[data[i] % 4], addr, 4);
+            loop_left -= loop_left > 0;
+        }
+    }
+    if (diff_run(&tb, msg, sizeof(msg))) {
+        diff_config(stderr);
+        fprintf(stderr, ": %s\n", msg);
+        abort();
+    }
+    free_trace(&tb);
+    return 0;
+}
+#endif
+
+
+#ifndef CSIM_FUZZ
+/*
+ * main:
+ * Main parses command line args, makes the cache, replays the memory accesses
+ * free the cache and print the summary statistics.  
+ */                    
+int main(int argc, char* argv[]) {                      
+	char* trace_file = NULL;
+	char* page_map_spec = NULL;
+	char* compact_out = NULL;
+	char* batch_manifest = NULL;
+	char* ir_dir = NULL;
+	int two_phase = 0;
+	int sectors = 1;
+	long check_iterations = 0;
+	long diff_iterations = 0;
+	char* cores_list = NULL;
+	int kv_policy = -1;
+	long long kv_capacity = 0;
+	static reuse_stats_t reuse_stats;
+	char trace_name[300];
+	double start, elapsed;
+	unsigned long long phys_mem = 16ULL << 30;
+	int bench = 0;
+	int c;
+
+	//Long options that have no single-letter form.
+	enum { OPT_BENCH = 256, OPT_BASELINE, OPT_TOLERANCE, OPT_PERF, OPT_PAGE_MAP,
+		OPT_PAGE_SIZE, OPT_PHYS_MEM, OPT_INDEX, OPT_SETS, OPT_SLICES,
+		OPT_VICTIM, OPT_MISS_CACHE, OPT_ICACHE, OPT_L2, OPT_COMPACT,
+		OPT_REUSE, OPT_FORMAT, OPT_BATCH, OPT_CHECK_DECODER, OPT_REGIONS,
+		OPT_ELF_SYMBOLS, OPT_HEAP_LOG, OPT_REGION_FILTER, OPT_HUGEPAGES,
+		OPT_POLICY, OPT_DUEL_EPOCH, OPT_TIMING, OPT_MSHRS, OPT_ISSUE_GAP,
+		OPT_HIT_LATENCY, OPT_L2_LATENCY, OPT_MEM_LATENCY, OPT_MEM_BANDWIDTH,
+		OPT_BLOOM, OPT_KV, OPT_KV_CAPACITY, OPT_SHARDS, OPT_SHARDS_MAX,
+		OPT_IR_CACHE, OPT_TWO_PHASE, OPT_PROGRESS,
+		OPT_SECTORS, OPT_COMPRESS, OPT_DIFF_TEST,
+		OPT_CORES, OPT_LLC };
+	static struct option long_opts[] = {
+		{"ir-cache", required_argument, NULL, OPT_IR_CACHE},
+		{"two-phase", no_argument, NULL, OPT_TWO_PHASE},
+		{"progress", required_argument, NULL, OPT_PROGRESS},
+		{"sectors", required_argument, NULL, OPT_SECTORS},
+		{"diff-test", required_argument, NULL, OPT_DIFF_TEST},
+		{"cores", required_argument, NULL, OPT_CORES},
+		{"llc", required_argument, NULL, OPT_LLC},
+		{"compress", required_argument, NULL, OPT_COMPRESS},
+		{"shards", required_argument, NULL, OPT_SHARDS},
+		{"shards-max", required_argument, NULL, OPT_SHARDS_MAX},
+		{"kv", required_argument, NULL, OPT_KV},
+		{"kv-capacity", required_argument, NULL, OPT_KV_CAPACITY},
+		{"bloom", no_argument, NULL, OPT_BLOOM},
+		{"timing", no_argument, NULL, OPT_TIMING},
+		{"mshrs", required_argument, NULL, OPT_MSHRS},
+		{"issue-gap", required_argument, NULL, OPT_ISSUE_GAP},
+		{"hit-latency", required_argument, NULL, OPT_HIT_LATENCY},
+		{"l2-latency", required_argument, NULL, OPT_L2_LATENCY},
+		{"mem-latency", required_argument, NULL, OPT_MEM_LATENCY},
+		{"mem-bandwidth", required_argument, NULL, OPT_MEM_BANDWIDTH},
+		{"policy", required_argument, NULL, OPT_POLICY},
+		{"duel-epoch", required_argument, NULL, OPT_DUEL_EPOCH},
+		{"hugepages", required_argument, NULL, OPT_HUGEPAGES},
+		{"regions", required_argument, NULL, OPT_REGIONS},
+		{"elf-symbols", required_argument, NULL, OPT_ELF_SYMBOLS},
+		{"heap-log", required_argument, NULL, OPT_HEAP_LOG},
+		{"region-filter", no_argument, NULL, OPT_REGION_FILTER},
+		{"check-decoder", required_argument, NULL, OPT_CHECK_DECODER},
+		{"batch", required_argument, NULL, OPT_BATCH},
+		{"format", required_argument, NULL, OPT_FORMAT},
+		{"reuse", no_argument, NULL, OPT_REUSE},
+		{"compact", required_argument, NULL, OPT_COMPACT},
+		{"icache", required_argument, NULL, OPT_ICACHE},
+		{"l2", required_argument, NULL, OPT_L2},
+		{"victim", required_argument, NULL, OPT_VICTIM},
+		{"miss-cache", required_argument, NULL, OPT_MISS_CACHE},
+		{"index", required_argument, NULL, OPT_INDEX},
+		{"sets", required_argument, NULL, OPT_SETS},
+		{"slices", required_argument, NULL, OPT_SLICES},
+		{"page-map", required_argument, NULL, OPT_PAGE_MAP},
+		{"page-size", required_argument, NULL, OPT_PAGE_SIZE},
+		{"phys-mem", required_argument, NULL, OPT_PHYS_MEM},
+		{"perf", no_argument, NULL, OPT_PERF},
+		{"bench", no_argument, NULL, OPT_BENCH},
+		{"baseline", required_argument, NULL, OPT_BASELINE},
+		{"tolerance", required_argument, NULL, OPT_TOLERANCE},
+		{NULL, 0, NULL, 0}
+	};
+
+	// Parse the command line arguments: -h, -v, -s, -E, -b, -t, -g, -n, -f, -r, -o, -j
+	while ((c = getopt_long(argc, argv, "s:E:b:t:g:n:f:r:o:j:vh", long_opts, NULL)) != -1) {
 		switch (c) {
+			case OPT_BENCH:
+				bench = 1;
+				break;
+			case OPT_BASELINE:
+				bench_baseline = optarg;
+				break;
+			case OPT_TOLERANCE:
+				bench_tolerance = atof(optarg);
+				break;
+			case OPT_PERF:
+				perf_mode = 1;
+				break;
+			case OPT_PAGE_MAP:
+				page_map_spec = optarg;
+				break;
+			case OPT_PAGE_SIZE:
+				page_shift = __builtin_ctzll(parse_size(optarg) | (1ULL << 63));
+				if (parse_size(optarg) != 1ULL << page_shift) {
+					printf("%s: --page-size must be a power of two\n", argv[0]);
+					exit(1);
+				}
+				break;
+			case OPT_PHYS_MEM:
+				phys_mem = parse_size(optarg);
+				break;
+			case OPT_INDEX:
+				if (strcmp(optarg, "mask") == 0) {
+					index_fn = INDEX_MASK;
+				} else if (strcmp(optarg, "xor") == 0) {
+					index_fn = INDEX_XOR;
+				} else if (strcmp(optarg, "complex") == 0) {
+					index_fn = INDEX_COMPLEX;
+				} else if (strcmp(optarg, "mod") == 0) {
+					index_fn = INDEX_MOD;
+				} else {
+					printf("%s: Unknown index function: %s\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case OPT_SETS:
+				num_sets = atoi(optarg);
+				break;
+			case OPT_SLICES:
+				num_slices = atoi(optarg);
+				break;
+			case OPT_VICTIM:
+				cache.vc_kind = VC_VICTIM;
+				cache.vc_size = atoi(optarg);
+				break;
+			case OPT_MISS_CACHE:
+				cache.vc_kind = VC_MISS;
+				cache.vc_size = atoi(optarg);
+				break;
+			case OPT_ICACHE:
+				parse_geometry(argv[0], optarg, &icache);
+				split_i = 1;
+				break;
+			case OPT_L2:
+				parse_geometry(argv[0], optarg, &l2cache);
+				use_l2 = 1;
+				break;
+			case OPT_COMPACT:
+				compact_out = optarg;
+				break;
+			case OPT_REUSE:
+				cache.reuse = &reuse_stats;
+				break;
+			case OPT_FORMAT:
+				if (strcmp(optarg, "text") == 0) {
+					out_format = FMT_TEXT;
+				} else if (strcmp(optarg, "json") == 0) {
+					out_format = FMT_JSON;
+				} else if (strcmp(optarg, "csv") == 0) {
+					out_format = FMT_CSV;
+				} else {
+					printf("%s: Unknown format: %s\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case 'o':
+				out_path = optarg;
+				break;
+			case OPT_BATCH:
+				batch_manifest = optarg;
+				break;
+			case OPT_CHECK_DECODER:
+				check_iterations = atol(optarg);
+				break;
+			case OPT_REGIONS:
+				load_region_file(optarg, 0);
+				break;
+			case OPT_ELF_SYMBOLS:
+				load_elf_symbols(optarg);
+				break;
+			case OPT_HEAP_LOG:
+				load_region_file(optarg, 1);
+				break;
+			case OPT_REGION_FILTER:
+				region_filter = 1;
+				break;
+			case OPT_SHARDS:
+				shards_rate = atof(optarg);
+				if (shards_rate <= 0.0 || shards_rate > 1.0) {
+					printf("%s: --shards needs a rate in (0, 1]\n", argv[0]);
+					exit(1);
+				}
+				break;
+			case OPT_SHARDS_MAX:
+				shards_max = atol(optarg);
+				break;
+			case OPT_IR_CACHE:
+				ir_dir = optarg;
+				break;
+			case OPT_TWO_PHASE:
+				two_phase = 1;
+				break;
+			case OPT_PROGRESS:
+				progress_interval = atof(optarg);
+				break;
+			case OPT_CORES:
+				cores_list = optarg;
+				break;
+			case OPT_LLC:
+				parse_geometry(argv[0], optarg, &llc_geometry);
+				break;
+			case OPT_DIFF_TEST:
+				diff_iterations = atol(optarg);
+				break;
+			case OPT_SECTORS:
+				sectors = atoi(optarg);
+				break;
+			case OPT_COMPRESS:
+				cache.compress_ratio = atof(optarg);
+				if (cache.compress_ratio < 1.0) {
+					printf("%s: --compress needs a ratio of at least 1\n", argv[0]);
+					exit(1);
+				}
+				break;
+			case OPT_KV:
+				for (kv_policy = 0; kv_policy < NUM_KV_POLICIES &&
+						strcmp(optarg, kv_policy_names[kv_policy]) != 0; kv_policy++)
+					;
+				if (kv_policy == NUM_KV_POLICIES) {
+					printf("%s: Unknown key-value policy: %s\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case OPT_KV_CAPACITY:
+				kv_capacity = parse_size(optarg);
+				break;
+			case OPT_BLOOM:
+				cache.use_bloom = 1;
+				break;
+			case OPT_TIMING:
+				timing = 1;
+				break;
+			case OPT_MSHRS:
+				num_mshrs = atoi(optarg);
+				break;
+			case OPT_ISSUE_GAP:
+				issue_gap = atol(optarg);
+				break;
+			case OPT_HIT_LATENCY:
+				hit_latency = atol(optarg);
+				break;
+			case OPT_L2_LATENCY:
+				l2_latency = atol(optarg);
+				break;
+			case OPT_MEM_LATENCY:
+				mem_latency = atol(optarg);
+				break;
+			case OPT_MEM_BANDWIDTH:
+				mem_bandwidth = atof(optarg);
+				break;
+			case OPT_POLICY:
+				cache.policy = find_policy(optarg);
+				if (cache.policy < 0) {
+					printf("%s: Unknown policy: %s\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case OPT_DUEL_EPOCH:
+				cache.duel_epoch = atol(optarg);
+				break;
+			case OPT_HUGEPAGES:
+				if (strcmp(optarg, "off") == 0) {
+					hugepage_mode = HUGE_OFF;
+				} else if (strcmp(optarg, "thp") == 0) {
+					hugepage_mode = HUGE_THP;
+				} else if (strcmp(optarg, "hugetlb") == 0) {
+					hugepage_mode = HUGE_TLB;
+				} else {
+					printf("%s: Unknown huge page mode: %s\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case 'j':
+				batch_nworkers = atoi(optarg);
+				break;
 			case 'b':
 				b = atoi(optarg);
 				break;
 			case 'E':
 				E = atoi(optarg);
 				break;
+			case 'f':
+				gen_footprint = parse_size(optarg);
+				break;
+			case 'g':
+				gen_spec = optarg;
+				break;
 			case 'h':
 				print_usage(argv);
 				exit(0);
+			case 'n':
+				gen_count = atol(optarg);
+				break;
+			case 'r':
+				gen_seed = strtoull(optarg, NULL, 0);
+				break;
 			case 's':
 				s = atoi(optarg);
 				break;
@@ -300,25 +7523,257 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	//All output, including the summary, goes to -o if given.
+	if (out_path != NULL && freopen(out_path, "w", stdout) == NULL) {
+		fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+		exit(1);
+	}
+
+	//Only the streaming replay of -t knows its position in the trace.
+	if (progress_interval > 0.0 && (trace_file == NULL || gen_spec != NULL ||
+			perf_mode || ir_dir != NULL || two_phase || batch_manifest != NULL ||
+			bench || kv_policy >= 0 || shards_rate > 0.0 || shards_max > 0 ||
+			cores_list != NULL || compact_out != NULL || check_iterations > 0 ||
+			diff_iterations > 0)) {
+		printf("%s: --progress only reports a plain -t replay, not -g, --perf,\n"
+			"--ir-cache, --two-phase, --batch, --bench, --kv, --shards, --cores,\n"
+			"--compact, --check-decoder or --diff-test\n", argv[0]);
+		exit(1);
+	}
+
+	init_decoder();
+	if (check_iterations > 0) {
+		return check_decoder(check_iterations);
+	}
+	if (diff_iterations > 0) {
+		return diff_test(diff_iterations);
+	}
+
+	//A batch run takes all configurations from its manifest.
+	if (batch_manifest != NULL) {
+		return run_batch(batch_manifest);
+	}
+
+	//The benchmark picks its own geometries and traces.
+	if (bench) {
+		if (trace_file != NULL) {
+			argv[--optind] = trace_file;
+		}
+		return run_bench(argv + optind, argc - optind);
+	}
+
+	//Key-value traces only need the trace and a capacity.
+	if (kv_policy >= 0) {
+		if (trace_file == NULL || kv_capacity <= 0) {
+			printf("%s: --kv needs -t and --kv-capacity\n", argv[0]);
+			exit(1);
+		}
+		return run_kv(trace_file, kv_policy, kv_capacity);
+	}
+
+	//A sampled miss-ratio curve covers all cache sizes of one block size.
+	if (shards_max > 0 && shards_rate == 0.0) {
+		shards_rate = 1.0;
+	}
+	if (shards_rate > 0.0) {
+		if (b == 0 || (trace_file == NULL && gen_spec == NULL)) {
+			printf("%s: --shards needs -b and -t or -g\n", argv[0]);
+			exit(1);
+		}
+		init_shards();
+		if (trace_file != NULL) {
+			check_compacted(trace_file, b, 0);
+		}
+		if (gen_spec != NULL) {
+			trace_buf_t gen = {0};
+			snprintf(trace_name, sizeof(trace_name), "gen:%s", gen_spec);
+			generate_trace(&gen);
+			start = now_sec();
+			replay_buffer(&gen);
+			elapsed = now_sec() - start;
+			free_trace(&gen);
+		} else {
+			snprintf(trace_name, sizeof(trace_name), "%s", trace_file);
+			start = now_sec();
+			replay_trace(trace_file);
+			elapsed = now_sec() - start;
+		}
+		report_mrc(trace_name, elapsed);
+		free_shards();
+		return 0;
+	}
+
+	//A multi-core run has its own traces and a cache hierarchy per core.
+	if (cores_list != NULL) {
+		if (E == 0 || b == 0 || llc_geometry.E == 0) {
+			printf("%s: --cores needs -s, -E, -b and --llc\n", argv[0]);
+			exit(1);
+		}
+		if (cache.vc_kind != VC_NONE || sectors != 1 || cache.compress_ratio > 0.0 ||
+				cache.use_bloom || index_fn != INDEX_MASK || num_slices != 1 ||
+				num_sets > 0 || timing || page_map_spec != NULL || split_i ||
+				cache.reuse != NULL || num_regions > 0 || verbosity) {
+			printf("%s: --cores does not model --victim, --miss-cache, --sectors,\n"
+				"--compress, --bloom, --index, --sets, --slices, --timing, --page-map,\n"
+				"--icache, --reuse, regions or -v\n", argv[0]);
+			exit(1);
+		}
+		l1_geometry.s = s;
+		l1_geometry.E = E;
+		l1_geometry.b = b;
+		return run_cores(cores_list);
+	}
+
+	//The compactor only needs the trace and the block size.
+	if (compact_out != NULL) {
+		if (trace_file == NULL || b == 0) {
+			printf("%s: --compact needs -t and -b\n", argv[0]);
+			exit(1);
+		}
+		compact_trace(trace_file, compact_out, b);
+		return 0;
+	}
+
 	//Make sure that all required command line args were specified.
-	if (s == 0 || E == 0 || b == 0 || trace_file == NULL) {
+	if ((s == 0 && num_sets <= 0) || E == 0 || b == 0 ||
+			(trace_file == NULL && gen_spec == NULL)) {
 		printf("%s: Missing required command line argument\n", argv[0]);
 		print_usage(argv);
 		exit(1);
 	}
 
-	//Initialize cache.
-	init_cache();
+	if (gen_spec != NULL) {
+		snprintf(trace_name, sizeof(trace_name), "gen:%s", gen_spec);
+	} else {
+		snprintf(trace_name, sizeof(trace_name), "%s", trace_file);
+	}
+
+	if (cache.use_bloom && cache.policy != POLICY_LRU) {
+		printf("%s: --bloom only supports the lru policy\n", argv[0]);
+		exit(1);
+	}
+	if (sectors < 1 || sectors > 64 || sectors > (1 << b) || (sectors & (sectors - 1))) {
+		printf("%s: --sectors needs a power of two up to 64 and 2^b\n", argv[0]);
+		exit(1);
+	}
+	while ((1 << cache.sector_bits) < sectors) {
+		cache.sector_bits++;
+	}
+	if (cache.use_bloom && (cache.sector_bits > 0 || cache.compress_ratio > 0.0)) {
+		printf("%s: --bloom does not model sectors or compression\n", argv[0]);
+		exit(1);
+	}
+
+	//Initialize cache. A compressed cache has more tags than lines of data.
+	cache.s = s;
+	cache.E = cache.compress_ratio > 0.0 ? E * COMPRESS_TAGS : E;
+	cache.data_ways = E;
+	cache.b = b;
+	cache.index_fn = index_fn;
+	cache.slices = num_slices;
+	cache.slice_sets = num_sets;
+	init_cache(&cache);
+	if (split_i) {
+		init_cache(&icache);
+	}
+	if (use_l2) {
+		init_cache(&l2cache);
+	}
+	if (timing) {
+		init_timing();
+	}
+	finish_regions();
+	if (region_filter && num_regions == 0) {
+		printf("%s: --region-filter needs a region map\n", argv[0]);
+		exit(1);
+	}
+	if (trace_file != NULL) {
+		check_compacted(trace_file, b, cache.sector_bits);
+		if (split_i) {
+			check_compacted(trace_file, icache.b, 0);
+		}
+		if (use_l2) {
+			check_compacted(trace_file, l2cache.b, 0);
+		}
+	}
+	if (page_map_spec != NULL) {
+		phys_frames = phys_mem >> page_shift;
+		if (phys_frames == 0) {
+			printf("%s: --phys-mem is smaller than a page\n", argv[0]);
+			exit(1);
+		}
+		init_page_map(page_map_spec);
+	}
+
+	//Count each phase separately: decode everything, replay, summarize.
+	if (perf_mode) {
+		trace_buf_t tb = {0};
+		perf_open();
+		perf_begin();
+		if (gen_spec != NULL) {
+			generate_trace(&tb);
+		} else {
+			load_trace(trace_file, &tb);
+		}
+		perf_end(PHASE_PARSE);
+		perf_begin();
+		start = now_sec();
+		replay_buffer(&tb);
+		elapsed = now_sec() - start;
+		perf_end(PHASE_ACCESS);
+		free_trace(&tb);
+		reuse_flush(&cache);
+		free_cache(&cache);
+		free_levels();
+		free_page_map();
+		perf_begin();
+		report_results(trace_name, elapsed);
+		perf_end(PHASE_SUMMARY);
+		perf_report(cache.hit_cnt + cache.miss_cnt);
+		free_duel(&cache);
+		free_regions();
+		free_timing();
+		return 0;
+	}
 
-	//Replay the memory access trace.
-	replay_trace(trace_file);
+	//Replay the memory access trace, or a generated one held in memory.
+	if (ir_dir != NULL || two_phase) {
+		if (gen_spec != NULL || !ir_supported()) {
+			printf("%s: --ir-cache and --two-phase need -t, the lru, lip or\n"
+				"srrip policy, and no side buffer, --icache, --l2, --reuse,\n"
+				"--timing, regions, page map, --bloom or -v\n", argv[0]);
+			exit(1);
+		}
+		elapsed = two_phase ? replay_two_phase(trace_file) : replay_ir(trace_file, ir_dir);
+	} else if (gen_spec != NULL) {
+		trace_buf_t gen = {0};
+		generate_trace(&gen);
+		start = now_sec();
+		replay_buffer(&gen);
+		elapsed = now_sec() - start;
+		free_trace(&gen);
+	} else {
+		if (progress_interval > 0.0) {
+			start_progress(trace_file);
+		}
+		start = now_sec();
+		replay_trace(trace_file);
+		elapsed = now_sec() - start;
+		if (progress_interval > 0.0) {
+			stop_progress();
+		}
+	}
 
 	//Free memory allocated for cache.
-	free_cache();
+	reuse_flush(&cache);
+	free_cache(&cache);
+	free_levels();
+	free_page_map();
 
-	//Print the statistics to a file.
-	//DO NOT REMOVE: This function must be called for test_csim to work.
-	print_summary(hit_cnt, miss_cnt, evict_cnt);
+	report_results(trace_name, elapsed);
+	free_duel(&cache);
+	free_regions();
+	free_timing();
 	return 0;   
 }  
-
+#endif
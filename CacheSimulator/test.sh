@@ -0,0 +1,109 @@
+#!/bin/sh
+# test.sh: builds csim with warnings as errors and checks it against known
+# results. Usage: ./test.sh [cc]. Exits non-zero on the first failure.
+
+cd "$(dirname "$0")" || exit 1
+SRC=$(pwd)
+CC=${1:-gcc}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+CSIM=$TMP/csim
+failures=0
+
+# check <expected first line> <csim args...>: runs csim and compares the
+# first line of its output.
+check() {
+    want=$1
+    shift
+    got=$("$CSIM" "$@" | head -1)
+    if [ "$got" != "$want" ]; then
+        echo "FAIL: csim $*"
+        echo "  got:  $got"
+        echo "  want: $want"
+        failures=$((failures + 1))
+    else
+        echo "ok: csim $*"
+    fi
+}
+
+"$CC" -O2 -Wall -Wextra -Werror -pthread -o "$CSIM" csim.c -lm || exit 1
+# Run in the scratch directory, where csim leaves its .csim_results file.
+cd "$TMP" || exit 1
+
+# The yi.trace of the CS:APP cache lab and its reference counts.
+cat > "$TMP/yi.trace" <<EOF
+ L 10,1
+ M 20,1
+ L 22,1
+ S 18,1
+ L 110,1
+ L 210,1
+ M 12,1
+EOF
+check "hits:4 misses:5 evictions:3" -s 4 -E 1 -b 4 -t "$TMP/yi.trace"
+check "hits:2 misses:7 evictions:5" -s 1 -E 1 -b 1 -t "$TMP/yi.trace"
+
+# Plain LRU runs against the original simulator from the repository's root
+# commit, on a mixed trace with unaligned accesses. Skipped outside git.
+BASE=$TMP/csim-base
+if git -C "$SRC" show "$(git -C "$SRC" rev-list --max-parents=0 HEAD | tail -1):CacheSimulator/csim.c" \
+        > "$TMP/base.c" 2> /dev/null &&
+        "$CC" -O2 -w -o "$BASE" "$TMP/base.c" -lm; then
+    awk 'BEGIN { srand(1); split("L S M", op, " ")
+        for (i = 0; i < 20000; i++)
+            printf " %s %x,%d\n", op[int(rand() * 3) + 1], int(rand() * 65536), 2 ^ int(rand() * 4) }' \
+        > "$TMP/mix.trace"
+    for cfg in "1 1 1" "4 1 4" "4 2 4" "5 1 5" "2 4 3" "1 8 6"; do
+        set -- $cfg
+        check "$("$BASE" -s $1 -E $2 -b $3 -t "$TMP/mix.trace" | head -1)" \
+            -s $1 -E $2 -b $3 -t "$TMP/mix.trace"
+    done
+else
+    echo "skip: no baseline simulator (not a git checkout)"
+fi
+
+# Generated traces, 200000 loads over a 1M footprint into 64 sets of 4
+# 64-byte lines. seq reads 8 bytes at a time, so 1 load in 8 starts a new
+# line: 25000 misses, all but the first 256 evicting. chase visits the 16384
+# lines in one cycle, so each set sees its 256 lines in a fixed rotation
+# and 4-way LRU never hits.
+G="-s 6 -E 4 -b 6 -n 200000 -f 1M -r 7"
+check "hits:175000 misses:25000 evictions:24744" $G -g seq
+check "hits:0 misses:200000 evictions:199744" $G -g chase
+check "Invalid zipf theta: 1 (needs 0 < theta < 1)" $G -g zipf:1
+
+# Snapshot tests: counts recorded from this implementation with -r 7, so
+# they only catch changes to the random streams, not wrong results.
+check "hits:3165 misses:196835 evictions:196579" $G -g random
+check "hits:67826 misses:132174 evictions:131918" $G -g zipf:0.9
+
+# A loop that a compacted trace folds must replay to the same counts as the
+# original trace, at the compaction block size and at any coarser one, and
+# a finer -b must be refused.
+i=0
+while [ $i -lt 200 ]; do
+    printf ' L %x,8\n S %x,8\n' $((i % 8 * 64)) $((4096 + i % 8 * 64))
+    i=$((i + 1))
+done > "$TMP/loop.trace"
+"$CSIM" --compact "$TMP/loop.c6" -b 6 -t "$TMP/loop.trace" > /dev/null
+grep -q '^R ' "$TMP/loop.c6" || { echo "FAIL: --compact folded no loop"; exit 1; }
+for b in 6 7; do
+    check "$("$CSIM" -s 2 -E 2 -b $b -t "$TMP/loop.trace" | head -1)" \
+        -s 2 -E 2 -b $b -t "$TMP/loop.c6"
+done
+check "$TMP/loop.c6: compacted at block size 2^6, needs -b 6 or more and no --sectors" \
+    -s 2 -E 2 -b 4 -t "$TMP/loop.c6"
+
+# The SIMD address decoder against sscanf() on random trace lines.
+check "decoder: 2000 cases match sscanf" --check-decoder 2000 -r 1
+
+# The optimized engines against the reference access_data() on random
+# configurations and traces.
+check "diff-test: 200 configurations, all engines agree with access_data()" \
+    --diff-test 200 -r 1
+
+if [ $failures -gt 0 ]; then
+    echo "$failures test(s) failed"
+    exit 1
+fi
+echo "all tests passed"